@@ -1,6 +1,8 @@
 
 #pragma once
 #include <libs/logger/Logger.hpp>
+#include <libs/delegate/Multicast.hpp>
+#include <libs/delegate/JsonScan.hpp>
 #include <jsoncpp/json/json.h>
 #include <fstream>
 #include <atomic>
@@ -175,8 +177,7 @@ using ValueFromStringFunction = std::function<bool(std::string i, T & val)>;
 template<typename T>
 static bool ValueFromStringDefault(const std::string i , T & val) throw(std::logic_error) {
 	Json::Value json;
-	Json::Reader reader;
-	if (!reader.parse(i,json)) {
+	if (!parse_json(i,json)) {
 		throw std::logic_error("[value_from_string] Unable to parse string as json: " + i );
 		return false;
 	}
@@ -262,9 +263,8 @@ public:
     			continue;
     		}
          	Json::Value json;
-         	Json::Reader reader;
 
-         	if (!reader.parse(attr.second,json)) {
+         	if (!parse_json(attr.second,json)) {
          		throw std::runtime_error("[ERROR] Unable to parse string to json: " + attr.second);
          	}
 
@@ -306,8 +306,7 @@ public:
 	/// @return detailed representation of parameter in json form
 	virtual bool from_json_string(std::string in) override {
 			Json::Value json;
-         	Json::Reader reader;
-         	if (!reader.parse(in,json)) {
+         	if (!parse_json(in,json)) {
          		std::string msg("[from_json_string][FAILED] Unable to parse string to json: " + in);
          		ERROR(msg);
          		return false;
@@ -337,6 +336,10 @@ public:
     // called when value changes
     std::function<void(Type)> on_change{[](Type t){return;}};
 
+    // any number of listeners called when value changes, after on_change.
+    // listeners may subscribe and unsubscribe while the value changes.
+    multicast_delegate<void(Type)> change_listeners;
+
 
 	virtual ~Parameter() {};
 
@@ -406,6 +409,7 @@ private:
 		 }
 
 		 on_change(to);
+		 change_listeners(to);
 
 		 return true;
 
@@ -645,8 +649,7 @@ public:
 		for (auto & p : _parameters)
 		{
 			Json::Value json;
-			Json::Reader reader;
-			reader.parse(p.second.get().json_string(),json);
+			parse_json(p.second.get().json_string(),json);
 			json_out[this->name()][p.second.get().name()] = json[p.second.get().name()];
 		}
 		return json_out.toStyledString();
@@ -690,8 +693,7 @@ public:
 	/// @return true if successfully read from json object
 	bool from_string( std::string in, bool check_complete = true ) {
 		Json::Value json;
-		Json::Reader reader;
-		if (!reader.parse(in,json)) {
+		if (!parse_json(in,json)) {
 			ERROR("[from_string][FAILED] Unable to parse json: " + in);
 			return false;
 		}
@@ -37,6 +37,22 @@ SCENARIO( "Numeric parameter can be created and reassigned", "[Numeric]" ) {
 
                 }
         }
+
+        WHEN( "change listeners are subscribed and numeric is changed to valid value" ) {
+        		int first_called = 0, second_called = 0;
+        		float_1.change_listeners += [&](float val){ first_called++; };
+        		auto second = float_1.change_listeners += [&](float val){ second_called++; };
+
+        		float_1 = 1;
+        		float_1.change_listeners -= second;
+        		float_1 = 2;
+
+        		THEN( "every subscribed listener is called" ) {
+        			REQUIRE( first_called == 2 );
+        			REQUIRE( second_called == 1 );
+                	REQUIRE( float_1 == 2.0 );
+                }
+        }
     }
 
     GIVEN( "An initialized numeric parameter" ) {
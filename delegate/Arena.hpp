@@ -0,0 +1,111 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+//---------------------------------------------------------------------------------
+/// monotonic_arena class
+/// bump allocator for objects that all die together, e.g. the delegates built
+/// while handling one request. deallocate() does nothing; release() hands every
+/// block back at once. not thread-safe: use one arena per request or thread.
+///
+///		monotonic_arena arena;
+///		delegate<int(int)> d(std::allocator_arg, arena_allocator<char>(arena), big_lambda);
+//---------------------------------------------------------------------------------
+class monotonic_arena
+{
+public:
+	explicit monotonic_arena(std::size_t block_size = 4096)
+	:_block_size(block_size)
+	{}
+
+	~monotonic_arena() { release(); }
+
+	monotonic_arena(const monotonic_arena &) = delete;
+	monotonic_arena & operator=(const monotonic_arena &) = delete;
+
+	void * allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t))
+	{
+		auto p = align(_current, alignment);
+		if (!p || p + size > _end) {
+			add_block(size + alignment);
+			p = align(_current, alignment);
+		}
+		_current = p + size;
+		return p;
+	}
+
+	void deallocate(void *, std::size_t) noexcept {}
+
+	/// free every block. objects allocated from the arena must be destroyed first.
+	void release() noexcept
+	{
+		while (_blocks) {
+			auto next = _blocks->next;
+			::operator delete(_blocks);
+			_blocks = next;
+		}
+		_current = _end = nullptr;
+	}
+
+private:
+	struct block
+	{
+		block * next;
+	};
+
+	static char * align(char * p, std::size_t alignment)
+	{
+		if (!p) {
+			return nullptr;
+		}
+		auto const address = reinterpret_cast<std::uintptr_t>(p);
+		return p + ((alignment - address % alignment) % alignment);
+	}
+
+	void add_block(std::size_t at_least)
+	{
+		auto const size = sizeof(block) + (at_least > _block_size ? at_least : _block_size);
+		auto b = static_cast<block *>(::operator new(size));
+		b->next = _blocks;
+		_blocks = b;
+		_current = reinterpret_cast<char *>(b + 1);
+		_end = reinterpret_cast<char *>(b) + size;
+	}
+
+	std::size_t _block_size;
+	block * _blocks{nullptr};
+	char * _current{nullptr};
+	char * _end{nullptr};
+};
+
+/// standard allocator drawing from a monotonic_arena
+template <typename T>
+class arena_allocator
+{
+public:
+	using value_type = T;
+
+	explicit arena_allocator(monotonic_arena & arena) noexcept :_arena(&arena) {}
+
+	template <typename U>
+	arena_allocator(const arena_allocator<U> & other) noexcept :_arena(other._arena) {}
+
+	T * allocate(std::size_t n)
+	{
+		return static_cast<T *>(_arena->allocate(n * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T * p, std::size_t n) noexcept { _arena->deallocate(p, n * sizeof(T)); }
+
+	template <typename U>
+	bool operator==(const arena_allocator<U> & other) const noexcept { return _arena == other._arena; }
+
+	template <typename U>
+	bool operator!=(const arena_allocator<U> & other) const noexcept { return _arena != other._arena; }
+
+private:
+	template <typename U> friend class arena_allocator;
+
+	monotonic_arena * _arena;
+};
@@ -0,0 +1,154 @@
+#pragma once
+#include <libs/delegate/Delegate.hpp>
+#include <type_traits>
+#include <utility>
+
+//---------------------------------------------------------------------------------
+/// compile-time aspect weaving
+/// an aspect is a copyable type providing "around" advice:
+///
+///   template <typename Next, typename... Args>
+///   decltype(auto) operator()(Next const & next, Args&&... args) const
+///
+/// it proceeds to the advised function by calling next(args...).
+/// weave<A1,...,An>(f) nests default constructed aspects around f (A1 outermost)
+/// into a single concrete callable the compiler can inline, and type-erases it
+/// once into a delegate, so an N aspect chain costs one indirect call instead
+/// of N. weave(f, a1, ..., an) does the same with copies of the given aspects,
+/// so aspects may carry state, such as a pointer to a call counter.
+//---------------------------------------------------------------------------------
+namespace aspect_detail {
+
+	/// the aspect of a layer. empty aspects take no space.
+	template <typename Aspect, bool = std::is_empty<Aspect>::value>
+	class stored : private Aspect
+	{
+	public:
+		explicit stored(Aspect aspect) :Aspect(std::move(aspect)) {}
+		const Aspect & aspect() const { return *this; }
+	};
+
+	template <typename Aspect>
+	class stored<Aspect, false>
+	{
+	public:
+		explicit stored(Aspect aspect) :_aspect(std::move(aspect)) {}
+		const Aspect & aspect() const { return _aspect; }
+
+	private:
+		Aspect _aspect;
+	};
+}
+
+/// one layer of woven advice
+template <typename Aspect, typename Next>
+class woven : private aspect_detail::stored<Aspect>
+{
+public:
+	woven(Aspect aspect, Next next) :aspect_detail::stored<Aspect>(std::move(aspect)), _next(std::move(next)) {}
+
+	template <typename... Args>
+	decltype(auto) operator()(Args&&... args) const
+	{
+		return this->aspect()(_next, std::forward<Args>(args)...);
+	}
+
+private:
+	Next _next;
+};
+
+namespace aspect_detail {
+
+	template <typename F, typename... Aspects>
+	struct chain;
+
+	template <typename F>
+	struct chain<F>
+	{
+		using type = F;
+		static type make(F f) { return f; }
+	};
+
+	template <typename F, typename Aspect, typename... Rest>
+	struct chain<F, Aspect, Rest...>
+	{
+		using type = woven<Aspect, typename chain<F, Rest...>::type>;
+		static type make(F f) { return type(Aspect(), chain<F, Rest...>::make(std::move(f))); }
+
+		static type make(F f, Aspect aspect, Rest... rest)
+		{
+			return type(std::move(aspect), chain<F, Rest...>::make(std::move(f), std::move(rest)...));
+		}
+	};
+
+}
+
+/// weave aspects around a function pointer, lambda or delegate.
+/// @return a delegate with the signature of f
+template <typename... Aspects, typename F>
+auto weave(F f)
+{
+	using signature = typename function_traits<F>::signature;
+	return delegate<signature>::from(aspect_detail::chain<F, Aspects...>::make(std::move(f)));
+}
+
+/// weave copies of aspects around a function pointer, lambda or delegate,
+/// the first one outermost.
+/// @return a delegate with the signature of f
+template <typename F, typename Aspect, typename... Rest>
+auto weave(F f, Aspect aspect, Rest... rest)
+{
+	using signature = typename function_traits<F>::signature;
+	return delegate<signature>::from(aspect_detail::chain<F, Aspect, Rest...>::make(std::move(f), std::move(aspect), std::move(rest)...));
+}
+
+/// turns advice called as advice(args...) into an aspect that runs it
+/// before the advised function.
+template <typename Advice>
+struct before : private Advice
+{
+	before() = default;
+	explicit before(Advice advice) :Advice(std::move(advice)) {}
+
+	template <typename Next, typename... Args>
+	decltype(auto) operator()(Next const & next, Args&&... args) const
+	{
+		static_cast<const Advice &>(*this)(args...);
+		return next(std::forward<Args>(args)...);
+	}
+};
+
+/// turns advice into an aspect that runs it after the advised function.
+/// the advice is called as advice(result, args...), or advice(args...) when
+/// the advised function returns void. the arguments are forwarded to the
+/// advised function and given to the advice as lvalues after it returned,
+/// and a reference result is returned as a reference.
+template <typename Advice>
+struct after : private Advice
+{
+	after() = default;
+	explicit after(Advice advice) :Advice(std::move(advice)) {}
+
+	template <typename Next, typename... Args>
+	decltype(auto) operator()(Next const & next, Args&&... args) const
+	{
+		using result_type = decltype(next(std::forward<Args>(args)...));
+		return call<result_type>(std::is_void<result_type>{}, next, std::forward<Args>(args)...);
+	}
+
+private:
+	template <typename R, typename Next, typename... Args>
+	void call(std::true_type, Next const & next, Args&&... args) const
+	{
+		next(std::forward<Args>(args)...);
+		static_cast<const Advice &>(*this)(args...);
+	}
+
+	template <typename R, typename Next, typename... Args>
+	R call(std::false_type, Next const & next, Args&&... args) const
+	{
+		decltype(auto) result = next(std::forward<Args>(args)...);
+		static_cast<const Advice &>(*this)(result, args...);
+		return static_cast<decltype(result) &&>(result);
+	}
+};
@@ -0,0 +1,615 @@
+#pragma once
+#include <libs/delegate/Delegate.hpp>
+#include <libs/delegate/Json.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <typeinfo>
+#include <vector>
+
+//---------------------------------------------------------------------------------
+/// asynchronous binary logging
+/// the logged aspect copies the arguments and result of every call into a ring
+/// buffer owned by the calling thread, in a compact binary encoding: trivially
+/// copyable values are copied as they are, strings as a length and their bytes.
+/// a log_sink thread drains the rings and either formats each record with the
+/// tuple operator<< of Json.hpp, or writes the records raw for decode() to
+/// format later. the calling thread never locks or formats: it copies the
+/// record and publishes it with a release store. a record that does not fit in
+/// a full ring is dropped and counted rather than waited for. the ring of a
+/// thread is reclaimed once the thread has exited and its records are written.
+/// a sink takes up to 2^20 sites and 4095 threads logging at the same time,
+/// add_site() and the first call logged by a thread beyond that throw
+/// std::length_error.
+///
+///		std::ofstream file("calls.log", std::ios::binary);
+///		log_sink sink(file, log_sink::raw);
+///		auto f = logged(sink, "score")(make_delegate(&score));
+//---------------------------------------------------------------------------------
+namespace log_detail {
+
+	/// binary encoding of a value
+	template <typename T, typename Enable = void>
+	struct codec
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable values and strings can be logged");
+		using value_type = T;
+
+		static std::size_t size(T const &) { return sizeof(T); }
+
+		static void write(char *& out, T const & value)
+		{
+			std::memcpy(out, &value, sizeof(T));
+			out += sizeof(T);
+		}
+
+		static T read(const char *& in)
+		{
+			T value;
+			std::memcpy(&value, in, sizeof(T));
+			in += sizeof(T);
+			return value;
+		}
+	};
+
+	struct string_codec
+	{
+		using value_type = std::string;
+
+		static std::size_t size(const char *, std::size_t length) { return sizeof(std::uint32_t) + length; }
+
+		static void write(char *& out, const char * s, std::size_t length)
+		{
+			auto const n = std::uint32_t(length);
+			std::memcpy(out, &n, sizeof(n));
+			std::memcpy(out + sizeof(n), s, n);
+			out += sizeof(n) + n;
+		}
+
+		static std::string read(const char *& in)
+		{
+			std::uint32_t n;
+			std::memcpy(&n, in, sizeof(n));
+			std::string value(in + sizeof(n), n);
+			in += sizeof(n) + n;
+			return value;
+		}
+	};
+
+	template <>
+	struct codec<std::string> : string_codec
+	{
+		static std::size_t size(std::string const & s) { return string_codec::size(s.data(), s.size()); }
+		static void write(char *& out, std::string const & s) { string_codec::write(out, s.data(), s.size()); }
+	};
+
+	template <typename C>
+	struct codec<C *, std::enable_if_t<std::is_same<std::remove_const_t<C>, char>::value>> : string_codec
+	{
+		static std::size_t size(const char * s) { return string_codec::size(s, std::strlen(s)); }
+		static void write(char *& out, const char * s) { string_codec::write(out, s, std::strlen(s)); }
+	};
+
+	template <typename T>
+	using codec_t = codec<std::decay_t<T>>;
+
+	inline std::size_t sum() { return 0; }
+
+	template <typename... N>
+	std::size_t sum(std::size_t first, N... rest) { return first + sum(rest...); }
+
+	struct header
+	{
+		std::uint32_t size;			// of the whole record, a multiple of sizeof(header)
+		std::uint32_t site;			// in a raw log, the thread is in the top 12 bits
+		std::uint64_t timestamp;
+	};
+
+	const std::uint32_t padding_site = 0xffffffff;		// fills the end of a ring
+	const std::uint32_t definition_site = 0xfffffffe;	// names a site in a raw log
+
+	const unsigned site_bits = 20;
+	const std::uint32_t max_site = (1u << site_bits) - 1;
+	// thread 0xfff together with the top sites would read as padding_site or definition_site
+	const unsigned max_thread = (1u << (32 - site_bits)) - 2;
+
+	inline std::uint32_t record_size(std::size_t payload)
+	{
+		return std::uint32_t((sizeof(header) + payload + sizeof(header) - 1) / sizeof(header) * sizeof(header));
+	}
+
+	/// single producer, single consumer byte ring
+	struct ring
+	{
+		ring(std::size_t capacity, unsigned thread)
+		:data(new char[capacity])
+		,capacity(capacity)
+		,thread(thread)
+		{}
+
+		/// space for a record of size bytes, nullptr if the ring is full
+		char * reserve(std::uint32_t size)
+		{
+			auto h = head.load(std::memory_order_relaxed);
+			auto const contiguous = capacity - h % capacity;
+			auto const needed = size <= contiguous ? size : size + contiguous;
+			if (h + needed - cached_tail > capacity) {
+				cached_tail = tail.load(std::memory_order_acquire);
+				if (h + needed - cached_tail > capacity) {
+					dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+					return nullptr;
+				}
+			}
+			if (size > contiguous) {
+				header padding{std::uint32_t(contiguous), padding_site, 0};
+				std::memcpy(data.get() + h % capacity, &padding, sizeof(padding));
+				pending = contiguous;
+				h += contiguous;
+			} else {
+				pending = 0;
+			}
+			return data.get() + h % capacity;
+		}
+
+		void commit(std::uint32_t size)
+		{
+			head.store(head.load(std::memory_order_relaxed) + pending + size, std::memory_order_release);
+		}
+
+		std::unique_ptr<char[]> data;
+		const std::size_t capacity;
+		const unsigned thread;
+		std::atomic<std::uint64_t> dropped{0};
+		// set by the producer when its thread exits
+		std::atomic<bool> closed{false};
+
+		// producer side, padded away from the consumer's cache line
+		char producer_padding[64];
+		std::atomic<std::uint64_t> head{0};
+		std::uint64_t cached_tail{0};
+		std::uint64_t pending{0};
+
+		// consumer side
+		char consumer_padding[64];
+		std::atomic<std::uint64_t> tail{0};
+	};
+
+	template <typename... T>
+	void print_arguments(std::ostream & out, std::tuple<T...> const & args) { out << args; }
+
+	inline void print_arguments(std::ostream & out, std::tuple<> const &) { out << "()"; }
+
+	template <typename R>
+	struct formatter
+	{
+		template <typename... Args>
+		static void format(std::ostream & out, const char * payload)
+		{
+			// braced initialization reads the arguments in order
+			std::tuple<typename codec_t<Args>::value_type...> args{codec_t<Args>::read(payload)...};
+			print_arguments(out, args);
+			out << " -> " << codec_t<R>::read(payload);
+		}
+	};
+
+	template <>
+	struct formatter<void>
+	{
+		template <typename... Args>
+		static void format(std::ostream & out, const char * payload)
+		{
+			std::tuple<typename codec_t<Args>::value_type...> args{codec_t<Args>::read(payload)...};
+			print_arguments(out, args);
+		}
+	};
+
+	struct site
+	{
+		std::string name;
+		std::string signature;
+		void (*format)(std::ostream &, const char *);
+	};
+}
+
+class log_sink
+{
+public:
+	enum format_type { text, raw };
+
+	/// @param ring_size bytes of the ring buffer of each calling thread
+	explicit log_sink(std::ostream & out, format_type format = text,
+			std::size_t ring_size = 1 << 16,
+			std::chrono::steady_clock::duration poll = std::chrono::milliseconds(1))
+	:_out(out)
+	,_format(format)
+	,_ring_size((ring_size + sizeof(log_detail::header) - 1) / sizeof(log_detail::header) * sizeof(log_detail::header))
+	,_poll(poll)
+	,_id(next_id())
+	,_start(now())
+	{
+		if (_format == raw) {
+			_out.write(magic(), magic_size);
+		}
+		_writer = std::thread([this] { run(); });
+	}
+
+	log_sink(const log_sink &) = delete;
+	log_sink & operator=(const log_sink &) = delete;
+
+	/// writes what is left in the rings. calls still being logged must have returned.
+	~log_sink()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopping = true;
+		}
+		_wake.notify_one();
+		_writer.join();
+	}
+
+	/// registers a call site and returns its id, not meant for the hot path
+	template <typename R, typename... Args>
+	std::uint32_t add_site(const std::string & name)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_sites.size() > log_detail::max_site) {
+			throw std::length_error("too many log sites");
+		}
+		_sites.push_back(log_detail::site{name, typeid(R(Args...)).name(),
+				&log_detail::formatter<R>::template format<Args...>});
+		return std::uint32_t(_sites.size() - 1);
+	}
+
+	/// logs the arguments and result of one call
+	template <typename R, typename... Args>
+	void log(std::uint32_t site, R const & result, Args const &... args)
+	{
+		auto const payload = log_detail::sum(log_detail::codec_t<Args>::size(args)...) + log_detail::codec_t<R>::size(result);
+		auto out = start(site, payload);
+		if (out) {
+			int expand[] = { 0, (log_detail::codec_t<Args>::write(out, args), 0)... };
+			(void)expand;
+			log_detail::codec_t<R>::write(out, result);
+			this_ring().commit(log_detail::record_size(payload));
+		}
+	}
+
+	/// logs the arguments of one call without result
+	template <typename... Args>
+	void log_void(std::uint32_t site, Args const &... args)
+	{
+		auto const payload = log_detail::sum(log_detail::codec_t<Args>::size(args)...);
+		auto out = start(site, payload);
+		if (out) {
+			int expand[] = { 0, (log_detail::codec_t<Args>::write(out, args), 0)... };
+			(void)expand;
+			this_ring().commit(log_detail::record_size(payload));
+		}
+	}
+
+	/// waits until every record logged before the call is written
+	/// and the rings of threads that exited before the call are reclaimed
+	void flush()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		// a drain in progress may have read the heads before the call
+		auto const target = _drains + 2;
+		if (_wanted < target) {
+			_wanted = target;
+		}
+		_wake.notify_one();
+		_drained.wait(lock, [&] { return _drains >= target; });
+		_out.flush();
+	}
+
+	/// records dropped because a ring was full
+	std::uint64_t dropped() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto total = _dropped;
+		for (auto & r : _rings) {
+			total += r->dropped.load(std::memory_order_relaxed);
+		}
+		return total;
+	}
+
+	/// formats a raw log written by a sink with the same sites, matched by name and signature
+	void decode(std::istream & in, std::ostream & out) const
+	{
+		char check[magic_size];
+		if (!in.read(check, magic_size) || std::memcmp(check, magic(), magic_size) != 0) {
+			throw std::runtime_error("not a raw delegate log");
+		}
+		std::map<std::uint32_t, const log_detail::site *> sites;
+		log_detail::header h;
+		std::vector<char> payload;
+		while (in.read(reinterpret_cast<char *>(&h), sizeof(h))) {
+			if (h.size < sizeof(h) || h.size % sizeof(h) != 0) {
+				throw std::runtime_error("corrupt raw delegate log");
+			}
+			payload.resize(h.size - sizeof(h));
+			if (!in.read(payload.data(), payload.size())) {
+				throw std::runtime_error("truncated raw delegate log");
+			}
+			const char * p = payload.data();
+			if (h.site == log_detail::definition_site) {
+				auto id = log_detail::codec<std::uint32_t>::read(p);
+				auto name = log_detail::string_codec::read(p);
+				auto signature = log_detail::string_codec::read(p);
+				std::lock_guard<std::mutex> lock(_mutex);
+				for (auto & s : _sites) {
+					if (s.name == name && s.signature == signature) {
+						sites[id] = &s;
+					}
+				}
+				continue;
+			}
+			auto thread = unsigned(h.site >> log_detail::site_bits);
+			auto found = sites.find(h.site & log_detail::max_site);
+			if (found == sites.end()) {
+				out << h.timestamp << " [" << thread << "] unknown site " << (h.site & log_detail::max_site) << '\n';
+			} else {
+				write_line(out, thread, h.timestamp, *found->second, p);
+			}
+		}
+	}
+
+private:
+	static const char * magic() { return "deleglog"; }
+	static const std::size_t magic_size = 8;
+
+	static std::uint64_t now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	static std::uint64_t next_id()
+	{
+		static std::atomic<std::uint64_t> id{1};
+		return id.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	char * start(std::uint32_t site, std::size_t payload)
+	{
+		auto const size = log_detail::record_size(payload);
+		auto & r = this_ring();
+		if (size > r.capacity) {
+			r.dropped.store(r.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		auto out = r.reserve(size);
+		if (!out) {
+			return nullptr;
+		}
+		log_detail::header h{size, site, now() - _start};
+		std::memcpy(out, &h, sizeof(h));
+		return out + sizeof(h);
+	}
+
+	log_detail::ring & this_ring()
+	{
+		struct cached { std::uint64_t sink; log_detail::ring * ring; };
+		static thread_local cached last{0, nullptr};
+		if (last.sink == _id) {
+			return *last.ring;
+		}
+		// closes the rings of this thread when it exits, unless their sink is gone
+		struct owned { std::uint64_t sink; std::weak_ptr<log_detail::ring> ring; };
+		struct thread_rings
+		{
+			~thread_rings()
+			{
+				for (auto & o : rings) {
+					if (auto r = o.ring.lock()) {
+						r->closed.store(true, std::memory_order_release);
+					}
+				}
+			}
+			std::vector<owned> rings;
+		};
+		static thread_local thread_rings known;
+		for (auto & k : known.rings) {
+			if (k.sink == _id) {
+				last = cached{_id, k.ring.lock().get()};
+				return *last.ring;
+			}
+		}
+		known.rings.erase(std::remove_if(known.rings.begin(), known.rings.end(),
+				[](owned const & o) { return o.ring.expired(); }), known.rings.end());
+		std::shared_ptr<log_detail::ring> added;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			// threads that exited leave their number to new ones
+			std::vector<bool> used(_rings.size() + 1, false);
+			for (auto & r : _rings) {
+				if (r->thread < used.size()) {
+					used[r->thread] = true;
+				}
+			}
+			auto const thread = unsigned(std::find(used.begin(), used.end(), false) - used.begin());
+			if (thread > log_detail::max_thread) {
+				throw std::length_error("too many logging threads");
+			}
+			added.reset(new log_detail::ring(_ring_size, thread));
+			_rings.push_back(added);
+		}
+		known.rings.push_back({_id, added});
+		last = cached{_id, added.get()};
+		return *added;
+	}
+
+	static void write_line(std::ostream & out, unsigned thread, std::uint64_t timestamp,
+			const log_detail::site & s, const char * payload)
+	{
+		out << timestamp << " [" << thread << "] " << s.name;
+		s.format(out, payload);
+		out << '\n';
+	}
+
+	void define(const log_detail::site & s, std::uint32_t id)
+	{
+		auto const payload = sizeof(id) + log_detail::codec<std::string>::size(s.name) + log_detail::codec<std::string>::size(s.signature);
+		std::vector<char> record(log_detail::record_size(payload), 0);
+		log_detail::header h{std::uint32_t(record.size()), log_detail::definition_site, 0};
+		std::memcpy(record.data(), &h, sizeof(h));
+		char * out = record.data() + sizeof(h);
+		log_detail::codec<std::uint32_t>::write(out, id);
+		log_detail::codec<std::string>::write(out, s.name);
+		log_detail::codec<std::string>::write(out, s.signature);
+		_out.write(record.data(), record.size());
+	}
+
+	// drain every ring once, returns false when there was nothing to write
+	bool drain(std::vector<bool> & defined)
+	{
+		std::vector<std::shared_ptr<log_detail::ring>> rings;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			rings = _rings;
+		}
+		// a ring closed before its head is read has nothing after that head
+		std::vector<bool> closed;
+		std::vector<std::uint64_t> heads;
+		for (auto & r : rings) {
+			closed.push_back(r->closed.load(std::memory_order_acquire));
+			heads.push_back(r->head.load(std::memory_order_acquire));
+		}
+		// sites used by these records were added before the records were published
+		std::lock_guard<std::mutex> lock(_mutex);
+		bool written = false;
+		for (std::size_t i = 0; i < rings.size(); i++) {
+			auto & r = *rings[i];
+			auto t = r.tail.load(std::memory_order_relaxed);
+			while (t < heads[i]) {
+				auto const record = r.data.get() + t % r.capacity;
+				log_detail::header h;
+				std::memcpy(&h, record, sizeof(h));
+				if (h.site != log_detail::padding_site) {
+					write_record(r, h, record, defined);
+					written = true;
+				}
+				t += h.size;
+			}
+			r.tail.store(t, std::memory_order_release);
+			if (closed[i]) {
+				_dropped += r.dropped.load(std::memory_order_relaxed);
+				_rings.erase(std::find(_rings.begin(), _rings.end(), rings[i]));
+			}
+		}
+		_drains++;
+		_drained.notify_all();
+		return written;
+	}
+
+	void write_record(log_detail::ring & r, log_detail::header h, const char * record, std::vector<bool> & defined)
+	{
+		if (_format == text) {
+			write_line(_out, r.thread, h.timestamp, _sites[h.site], record + sizeof(h));
+			return;
+		}
+		if (defined.size() <= h.site) {
+			defined.resize(h.site + 1, false);
+		}
+		if (!defined[h.site]) {
+			define(_sites[h.site], h.site);
+			defined[h.site] = true;
+		}
+		// the thread goes in the top bits of the site id
+		h.site |= r.thread << log_detail::site_bits;
+		_out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+		_out.write(record + sizeof(h), h.size - sizeof(h));
+	}
+
+	void run()
+	{
+		std::vector<bool> defined;
+		for (;;) {
+			while (drain(defined)) {}
+			std::unique_lock<std::mutex> lock(_mutex);
+			if (_stopping) {
+				break;
+			}
+			_wake.wait_for(lock, _poll, [this] { return _stopping || _drains < _wanted; });
+		}
+		drain(defined);
+		std::lock_guard<std::mutex> lock(_mutex);
+		_out.flush();
+	}
+
+	std::ostream & _out;
+	const format_type _format;
+	const std::size_t _ring_size;
+	const std::chrono::steady_clock::duration _poll;
+	const std::uint64_t _id;
+	const std::uint64_t _start;
+
+	mutable std::mutex _mutex;
+	std::condition_variable _wake;
+	std::condition_variable _drained;
+	std::uint64_t _drains = 0;		// passes of drain()
+	std::uint64_t _wanted = 0;		// passes flush() waits for
+	std::vector<std::shared_ptr<log_detail::ring>> _rings;
+	std::uint64_t _dropped = 0;		// by reclaimed rings
+	std::vector<log_detail::site> _sites;
+	bool _stopping = false;
+	std::thread _writer;
+};
+
+//---------------------------------------------------------------------------------
+/// logged aspect
+/// logs every call of the wrapped delegate to a log_sink. arguments are recorded
+/// after the call returned, together with its result.
+//---------------------------------------------------------------------------------
+class logged
+{
+public:
+	logged(log_sink & sink, std::string name) :_sink(&sink), _name(std::move(name)) {}
+
+	template<typename R, typename... Args>
+	delegate<R(Args...)> operator () (delegate<R(Args...)> f) const
+	{
+		return wrap(f, std::is_void<R>());
+	}
+
+private:
+	template<typename R, typename... Args>
+	delegate<R(Args...)> wrap(delegate<R(Args...)> f, std::false_type) const
+	{
+		auto sink = _sink;
+		auto site = sink->add_site<std::decay_t<R>, std::decay_t<Args>...>(_name);
+		return [sink,site,f](delegate_param_t<Args>... args) -> R
+		{
+			R ret = f(args...);
+			sink->log(site, ret, args...);
+			return ret;
+		};
+	}
+
+	template<typename R, typename... Args>
+	delegate<R(Args...)> wrap(delegate<R(Args...)> f, std::true_type) const
+	{
+		auto sink = _sink;
+		auto site = sink->add_site<void, std::decay_t<Args>...>(_name);
+		return [sink,site,f](delegate_param_t<Args>... args)
+		{
+			f(args...);
+			sink->log_void(site, args...);
+		};
+	}
+
+	log_sink * _sink;
+	std::string _name;
+};
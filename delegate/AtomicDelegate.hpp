@@ -0,0 +1,82 @@
+#pragma once
+#include <libs/delegate/Delegate.hpp>
+#include <libs/delegate/Epoch.hpp>
+#include <atomic>
+
+//---------------------------------------------------------------------------------
+/// atomic_delegate class
+/// a delegate slot that can be re-pointed while other threads call it,
+/// e.g. to turn tracing on for one advised function at runtime.
+/// calls are wait-free: an epoch_guard plus one acquire load of the target.
+/// replacing the target is lock-free; the previous target is reclaimed
+/// through epoch_retire once no call can still be using it.
+//---------------------------------------------------------------------------------
+template <typename T> class atomic_delegate;
+
+template<class R, class ...A>
+class atomic_delegate<R (A...)>
+{
+public:
+  using delegate_type = delegate<R (A...)>;
+
+  atomic_delegate() = default;
+
+  explicit atomic_delegate(delegate_type d) :
+    target_(make_target(::std::move(d)))
+  {
+  }
+
+  atomic_delegate(atomic_delegate const&) = delete;
+
+  atomic_delegate& operator=(atomic_delegate const&) = delete;
+
+  /// must not race with calls
+  ~atomic_delegate() { delete target_.load(::std::memory_order_relaxed); }
+
+  /// replaces the target, calls already in progress finish on the old one
+  void store(delegate_type d)
+  {
+    epoch_retire(target_.exchange(make_target(::std::move(d)),
+      ::std::memory_order_acq_rel));
+  }
+
+  atomic_delegate& operator=(delegate_type d)
+  {
+    store(::std::move(d));
+
+    return *this;
+  }
+
+  /// copy of the current target
+  delegate_type load() const
+  {
+    epoch_guard guard;
+
+    auto const target = target_.load(::std::memory_order_acquire);
+
+    return target ? *target : delegate_type();
+  }
+
+  explicit operator bool() const noexcept
+  {
+    return target_.load(::std::memory_order_acquire);
+  }
+
+  R operator()(delegate_param_t<A>... args) const
+  {
+    epoch_guard guard;
+
+    auto const target = target_.load(::std::memory_order_acquire);
+
+//  assert(target);
+    return (*target)(::std::forward<delegate_param_t<A>>(args)...);
+  }
+
+private:
+  ::std::atomic<delegate_type*> target_{nullptr};
+
+  static delegate_type* make_target(delegate_type d)
+  {
+    return d ? new delegate_type(::std::move(d)) : nullptr;
+  }
+};
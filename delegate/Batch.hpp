@@ -0,0 +1,195 @@
+#pragma once
+#include <libs/delegate/Delegate.hpp>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+//---------------------------------------------------------------------------------
+/// batcher class
+/// queues single calls and hands them to a batch implementation taking a vector
+/// of argument tuples and returning one result per tuple, in order.
+/// a batch is flushed by a background thread once it holds max_size calls, or
+/// window after its first call arrived, whichever comes first.
+/// callers only push to a vector under a mutex, then wait on their own future.
+///
+///		batcher<int(int)> lookup(make_delegate(&lookup_all), 64, std::chrono::microseconds(200));
+///		std::future<int> a = lookup(1), b = lookup(2);
+//---------------------------------------------------------------------------------
+template <typename T> class batcher;
+
+template <typename R, typename... A>
+class batcher<R(A...)>
+{
+public:
+	static_assert(!std::is_void<R>::value, "a batch must return one result per call");
+
+	using item_type = std::tuple<std::decay_t<A>...>;
+	using batch_type = delegate<std::vector<R>(std::vector<item_type>)>;
+
+	batcher(batch_type implementation, std::size_t max_size, std::chrono::steady_clock::duration window)
+	:_implementation(std::move(implementation))
+	,_max_size(max_size ? max_size : 1)
+	,_window(window)
+	,_flusher([this] { run(); })
+	{}
+
+	batcher(const batcher &) = delete;
+	batcher & operator=(const batcher &) = delete;
+
+	/// flushes pending calls before returning
+	~batcher()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopping = true;
+		}
+		_wake.notify_one();
+		_flusher.join();
+	}
+
+	std::future<R> operator () (delegate_param_t<A>... args)
+	{
+		std::promise<R> promise;
+		auto result = promise.get_future();
+		std::size_t pending;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (_items.empty()) {
+				_first_call = std::chrono::steady_clock::now();
+			}
+			_items.emplace_back(std::forward<delegate_param_t<A>>(args)...);
+			_promises.push_back(std::move(promise));
+			pending = _items.size();
+		}
+		if (pending == 1 || pending == _max_size) {
+			_wake.notify_one();
+		}
+		return result;
+	}
+
+private:
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		for (;;) {
+			_wake.wait(lock, [this] { return _stopping || !_items.empty(); });
+			if (_items.empty()) {
+				return;
+			}
+			_wake.wait_until(lock, _first_call + _window,
+					[this] { return _stopping || _items.size() >= _max_size; });
+
+			std::vector<item_type> items;
+			std::vector<std::promise<R>> promises;
+			items.swap(_items);
+			promises.swap(_promises);
+			lock.unlock();
+			for (std::size_t begin = 0; begin < items.size(); begin += _max_size) {
+				flush(items, promises, begin, std::min(items.size(), begin + _max_size));
+			}
+			lock.lock();
+		}
+	}
+
+	void flush(std::vector<item_type> & items, std::vector<std::promise<R>> & promises, std::size_t begin, std::size_t end)
+	{
+		try {
+			std::vector<item_type> chunk;
+			if (begin == 0 && end == items.size()) {
+				chunk.swap(items);
+			} else {
+				chunk.assign(std::make_move_iterator(items.begin() + begin), std::make_move_iterator(items.begin() + end));
+			}
+			auto results = _implementation(std::move(chunk));
+			if (results.size() != end - begin) {
+				throw std::length_error("batch returned a wrong number of results");
+			}
+			for (std::size_t i = begin; i < end; i++) {
+				promises[i].set_value(std::move(results[i - begin]));
+			}
+		} catch (...) {
+			for (std::size_t i = begin; i < end; i++) {
+				promises[i].set_exception(std::current_exception());
+			}
+		}
+	}
+
+	batch_type _implementation;
+	std::size_t _max_size;
+	std::chrono::steady_clock::duration _window;
+
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::vector<item_type> _items;
+	std::vector<std::promise<R>> _promises;
+	std::chrono::steady_clock::time_point _first_call;
+	bool _stopping = false;
+
+	// started last, once every other member is constructed
+	std::thread _flusher;
+};
+
+//---------------------------------------------------------------------------------
+/// batch aspect
+/// turns a batch implementation into a delegate called once per item, which
+/// blocks until the batch holding its call has run. calls made concurrently
+/// from many threads are coalesced into one call of the implementation.
+/// the parameters of the delegate are the types of the item tuple. the queued
+/// calls keep decayed copies of their arguments, and an item tuple of
+/// references, such as std::tuple<const std::string &>, refers to those copies.
+///
+///		batch coalesce(64, std::chrono::microseconds(200));
+///		functions.add_function("score", coalesce(delegate<std::vector<double>(std::vector<std::tuple<int>>)>(score_all)));
+//---------------------------------------------------------------------------------
+class batch
+{
+public:
+	explicit batch(std::size_t max_size = 64,
+			std::chrono::steady_clock::duration window = std::chrono::microseconds(100))
+	:_max_size(max_size)
+	,_window(window)
+	{}
+
+	template<typename R, typename... Args>
+	delegate<R(Args...)> operator () (delegate<std::vector<R>(std::vector<std::tuple<Args...>>)> implementation) const
+	{
+		using queue_type = batcher<R(std::decay_t<Args>...)>;
+		auto queue = std::make_shared<queue_type>(
+				adapt<R, Args...>(std::move(implementation), std::is_same<std::tuple<Args...>, std::tuple<std::decay_t<Args>...>>()),
+				_max_size, _window);
+		return [queue](delegate_param_t<Args>... args)
+		{
+			return (*queue)(std::forward<delegate_param_t<Args>>(args)...).get();
+		};
+	}
+
+private:
+	template<typename R, typename... Args>
+	static delegate<std::vector<R>(std::vector<std::tuple<Args...>>)> adapt(
+			delegate<std::vector<R>(std::vector<std::tuple<Args...>>)> implementation, std::true_type)
+	{
+		return implementation;
+	}
+
+	// items of references to the queued copies, valid for the call of the implementation
+	template<typename R, typename... Args>
+	static delegate<std::vector<R>(std::vector<std::tuple<std::decay_t<Args>...>>)> adapt(
+			delegate<std::vector<R>(std::vector<std::tuple<Args...>>)> implementation, std::false_type)
+	{
+		return [implementation](std::vector<std::tuple<std::decay_t<Args>...>> items)
+		{
+			std::vector<std::tuple<Args...>> references(std::make_move_iterator(items.begin()), std::make_move_iterator(items.end()));
+			return implementation(std::move(references));
+		};
+	}
+
+	std::size_t _max_size;
+	std::chrono::steady_clock::duration _window;
+};
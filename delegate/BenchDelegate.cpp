@@ -0,0 +1,495 @@
+#include <libs/delegate/Delegate.hpp>
+#include <libs/delegate/Aspect.hpp>
+#include <libs/delegate/AtomicDelegate.hpp>
+#include <libs/delegate/Timed.hpp>
+#include <libs/delegate/AsyncLog.hpp>
+#include <libs/delegate/Trace.hpp>
+#include <libs/delegate/Executor.hpp>
+#include <libs/delegate/TimerWheel.hpp>
+#include <libs/delegate/Json.hpp>
+#include <libs/delegate/JsonScan.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Measures construction, copy, move, destruction and invocation of delegates
+// against std::function, virtual calls and raw function pointers.
+//
+// usage: benchDelegate [iterations] [--json]
+// prints one row per subject and operation, as csv unless --json is given:
+//		subject,operation,ns_per_op
+
+// keep the compiler from optimizing a value away
+template <typename T>
+inline void do_not_optimize(T const & value)
+{
+	asm volatile("" : : "g"(&value) : "memory");
+}
+
+using clock_type = std::chrono::steady_clock;
+
+double elapsed_ns(clock_type::time_point start)
+{
+	return std::chrono::duration<double,std::nano>(clock_type::now() - start).count();
+}
+
+struct result
+{
+	std::string subject;
+	std::string operation;
+	double ns_per_op;
+};
+
+std::vector<result> results;
+
+void record(const std::string & subject, const std::string & operation, double ns_per_op)
+{
+	results.push_back({subject, operation, ns_per_op});
+}
+
+// objects are constructed, copied, moved and destroyed in batches,
+// so the clock is read once per batch rather than once per object
+const std::size_t batch = 1024;
+
+// time construct, copy, move and destroy of T, and n calls of invoke on one T
+template <typename T, typename Make, typename Invoke>
+void bench(const std::string & subject, std::size_t n, Make make, Invoke invoke)
+{
+	using slot = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+	std::vector<slot> a(batch), b(batch);
+	auto objects = reinterpret_cast<T *>(a.data());
+	auto others = reinterpret_cast<T *>(b.data());
+
+	double construct = 0, copy = 0, move = 0, destroy = 0;
+	const std::size_t rounds = n / batch + 1;
+	for (std::size_t r = 0; r < rounds; r++) {
+		auto start = clock_type::now();
+		for (std::size_t i = 0; i < batch; i++) {
+			new (&objects[i]) T(make());
+		}
+		do_not_optimize(a);
+		construct += elapsed_ns(start);
+
+		start = clock_type::now();
+		for (std::size_t i = 0; i < batch; i++) {
+			new (&others[i]) T(objects[i]);
+		}
+		do_not_optimize(b);
+		copy += elapsed_ns(start);
+
+		start = clock_type::now();
+		for (std::size_t i = 0; i < batch; i++) {
+			others[i].~T();
+		}
+		do_not_optimize(b);
+		destroy += elapsed_ns(start);
+
+		start = clock_type::now();
+		for (std::size_t i = 0; i < batch; i++) {
+			new (&others[i]) T(std::move(objects[i]));
+		}
+		do_not_optimize(b);
+		move += elapsed_ns(start);
+
+		for (std::size_t i = 0; i < batch; i++) {
+			objects[i].~T();
+			others[i].~T();
+		}
+	}
+	const double ops = double(rounds * batch);
+	record(subject, "construct", construct / ops);
+	record(subject, "copy", copy / ops);
+	record(subject, "move", move / ops);
+	record(subject, "destroy", destroy / ops);
+
+	T subject_object(make());
+	const T * p = &subject_object;
+	int sum = 0;
+	auto start = clock_type::now();
+	for (std::size_t i = 0; i < n; i++) {
+		do_not_optimize(p);
+		sum += invoke(*p, int(i));
+	}
+	record(subject, "invoke", elapsed_ns(start) / n);
+	do_not_optimize(sum);
+}
+
+// time n calls of f only, for subjects that cannot be copied
+template <typename F>
+void bench_invoke(const std::string & subject, std::size_t n, F & f)
+{
+	int sum = 0;
+	auto start = clock_type::now();
+	for (std::size_t i = 0; i < n; i++) {
+		do_not_optimize(f);
+		sum += f(int(i));
+	}
+	record(subject, "invoke", elapsed_ns(start) / n);
+	do_not_optimize(sum);
+}
+
+int free_function(int i) { return 3 * i + 4; }
+
+struct target {
+	int method(int i) { return c * i + 4; }
+	int c = 3;
+};
+
+struct base {
+	virtual ~base() {}
+	virtual int call(int i) const = 0;
+};
+
+struct derived : base {
+	int call(int i) const override { return c * i + 4; }
+	int c = 3;
+};
+
+// around advice that only proceeds
+struct pass_through {
+	template <typename Next, typename... Args>
+	decltype(auto) operator()(Next const & next, Args&&... args) const
+	{
+		return next(std::forward<Args>(args)...);
+	}
+};
+
+// the same advice applied at runtime, one delegate per layer
+template <typename R, typename... Args>
+delegate<R(Args...)> pass_through_layer(delegate<R(Args...)> f)
+{
+	return [f](delegate_param_t<Args>... args) { return f(args...); };
+}
+
+// binary tree of tasks, each forking one child: 2^depth tiny tasks in total
+long spawn_tree(executor & pool, int depth)
+{
+	if (depth == 0) {
+		return 1;
+	}
+	auto left = pool.async([&pool,depth] { return spawn_tree(pool, depth - 1); });
+	auto right = spawn_tree(pool, depth - 1);
+	return left.get() + right;
+}
+
+// fine-grained fork-join throughput for 1, 2, 4 ... hardware threads
+void bench_executor(std::size_t n)
+{
+	const int depth = 16;
+	const std::size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+	for (std::size_t threads = 1; ; threads = std::min(threads * 2, hardware)) {
+		executor pool(threads);
+		const std::size_t rounds = std::max<std::size_t>(1, n >> (depth + 2));
+		long tasks = 0;
+		auto start = clock_type::now();
+		for (std::size_t r = 0; r < rounds; r++) {
+			tasks += pool.async([&pool] { return spawn_tree(pool, depth); }).get();
+		}
+		record("executor_" + std::to_string(threads) + "_threads", "task", elapsed_ns(start) / tasks);
+		if (threads == hardware) {
+			break;
+		}
+	}
+}
+
+// decodes the json arguments of f with the former two-pass json_to_tuple and with
+// decode_json_tuple, then calls f through make_json_function, from a Json::Value,
+// from text parsed by Json::Reader, from text read by make_json_string_function
+// and from MessagePack read by make_binary_function
+template <typename F>
+void bench_json_decode(const std::string & subject, std::size_t n, F f, const std::string & arguments)
+{
+	Json::Value args;
+	Json::Reader().parse(arguments, args);
+	auto parameters = decltype(make_delegate(f))::tuple();
+	auto start = clock_type::now();
+	for (std::size_t i = 0; i < n; i++) {
+		json_to_tuple(args, parameters);
+		do_not_optimize(parameters);
+	}
+	record(subject, "two_pass_decode", elapsed_ns(start) / n);
+	start = clock_type::now();
+	for (std::size_t i = 0; i < n; i++) {
+		decode_json_tuple(args, parameters);
+		do_not_optimize(parameters);
+	}
+	record(subject, "decode", elapsed_ns(start) / n);
+	auto json_f = make_json_function(f);
+	start = clock_type::now();
+	for (std::size_t i = 0; i < n; i++) {
+		auto result = json_f(args);
+		do_not_optimize(result);
+	}
+	record(subject, "call", elapsed_ns(start) / n);
+	start = clock_type::now();
+	for (std::size_t i = 0; i < n; i++) {
+		Json::Value parsed;
+		Json::Reader().parse(arguments, parsed);
+		auto result = json_f(parsed);
+		do_not_optimize(result);
+	}
+	record(subject, "parse_and_call", elapsed_ns(start) / n);
+	auto string_f = make_json_string_function(f);
+	start = clock_type::now();
+	for (std::size_t i = 0; i < n; i++) {
+		Json::Value result;
+		string_f(arguments, result);
+		do_not_optimize(result);
+	}
+	record(subject, "stream_call", elapsed_ns(start) / n);
+	std::string packed;
+	msgpack_codec::encode(args, packed);
+	auto binary_f = make_binary_function(f);
+	start = clock_type::now();
+	for (std::size_t i = 0; i < n; i++) {
+		std::string result;
+		binary_f(packed, result);
+		do_not_optimize(result);
+	}
+	record(subject, "binary_call", elapsed_ns(start) / n);
+}
+
+void bench_json_decode(std::size_t n)
+{
+	bench_json_decode("json_1_arg", n, [](int a) { return a; }, "[1]");
+	bench_json_decode("json_5_args", n, [](int a, std::string b, double c, bool d, int e) {
+		return a + int(b.size()) + c + d + e;
+	}, R"([1,"abcd",1.5,true,5])");
+	bench_json_decode("json_20_args", n, [](int a, std::string b, double c, bool d, int e,
+			int f, std::string g, double h, bool i, int j,
+			int k, std::string l, double m, bool o, int p,
+			int q, std::string r, double s, bool t, int u) {
+		return a + b.size() + c + d + e + f + g.size() + h + i + j
+			+ k + l.size() + m + o + p + q + r.size() + s + t + u;
+	}, R"([1,"abcd",1.5,true,5,1,"abcd",1.5,true,5,1,"abcd",1.5,true,5,1,"abcd",1.5,true,5])");
+}
+
+// parses text n times with Json::Reader and with the scanner, and indexes it with each scanner kernel
+void bench_json_scan(const std::string & subject, std::size_t n, const std::string & text)
+{
+	auto start = clock_type::now();
+	for (std::size_t i = 0; i < n; i++) {
+		Json::Value value;
+		json_scan::reader_parse(text, value);
+		do_not_optimize(value);
+	}
+	record(subject, "reader_parse", elapsed_ns(start) / n);
+	start = clock_type::now();
+	for (std::size_t i = 0; i < n; i++) {
+		Json::Value value;
+		json_scan::scan_parse(text, value);
+		do_not_optimize(value);
+	}
+	record(subject, "scan_parse", elapsed_ns(start) / n);
+	std::vector<std::uint32_t> positions;
+	const char * names[] = { "index_scalar", "index_sse42", "index_avx2" };
+	for (auto k : { json_scan::kernel::scalar, json_scan::kernel::sse42, json_scan::kernel::avx2 }) {
+		if (k > json_scan::best_kernel()) {
+			break;
+		}
+		start = clock_type::now();
+		for (std::size_t i = 0; i < n; i++) {
+			json_scan::index(text, positions, k);
+			do_not_optimize(positions);
+		}
+		record(subject, names[int(k)], elapsed_ns(start) / n);
+	}
+}
+
+// a parameter file of about a megabyte, and the body of a small json-rpc request
+void bench_json_scan(std::size_t n)
+{
+	std::string parameters = "{\"parameters\":{";
+	for (int i = 0; parameters.size() < (1 << 20); i++) {
+		auto const name = "\"module_" + std::to_string(i) + "\"";
+		parameters += (i ? "," : "") + name + ":{\"enabled\":" + (i % 2 ? "true" : "false")
+			+ ",\"rate\":" + std::to_string(i * 0.125) + ",\"count\":" + std::to_string(i * 7)
+			+ ",\"path\":\"/var/lib/module/" + std::to_string(i) + "/data\\u00e9\""
+			+ ",\"limits\":[1,2,4,8,16,32],\"description\":\"module " + std::to_string(i)
+			+ " of the parameter file, with a \\\"quoted\\\" word\"}";
+	}
+	parameters += "}}";
+	bench_json_scan("json_scan_1MB_parameters", n / 100000 + 1, parameters);
+	bench_json_scan("json_scan_rpc_body", n,
+		R"({"jsonrpc":"2.0","method":"describe","params":[1,"abcd",1.5,true],"id":17})");
+}
+
+// looks up the functions of a registry of 2000 by name, in a std::map and with resolve(),
+// and calls one through its handle
+void bench_function_lookup(std::size_t n)
+{
+	const int count = 2000;
+	JsonFunctions functions;
+	std::map<std::string,JsonFunctions::json_function> by_name;
+	std::vector<std::string> names;
+	for (int i = 0; i < count; i++) {
+		names.push_back("service.module_" + std::to_string(i) + ".method");
+		functions.add_function(names.back(), [i](int a) { return a + i; });
+		by_name[names.back()] = make_json_function([i](int a) { return a + i; });
+	}
+	auto start = clock_type::now();
+	for (std::size_t i = 0; i < n; i++) {
+		auto & f = by_name.at(names[i % count]);
+		do_not_optimize(f);
+	}
+	record("functions_2000", "map_lookup", elapsed_ns(start) / n);
+	start = clock_type::now();
+	for (std::size_t i = 0; i < n; i++) {
+		auto h = functions.resolve(names[i % count]);
+		do_not_optimize(h);
+	}
+	record("functions_2000", "resolve", elapsed_ns(start) / n);
+	Json::Value args(Json::arrayValue);
+	args.append(1);
+	auto h = functions.resolve(names[count / 2]);
+	start = clock_type::now();
+	for (std::size_t i = 0; i < n; i++) {
+		auto result = functions.call(h, args);
+		do_not_optimize(result);
+	}
+	record("functions_2000", "call_by_handle", elapsed_ns(start) / n);
+	start = clock_type::now();
+	for (std::size_t i = 0; i < n; i++) {
+		auto result = functions.call(names[count / 2], args);
+		do_not_optimize(result);
+	}
+	record("functions_2000", "call_by_name", elapsed_ns(start) / n);
+}
+
+// schedules a million timers, cancels half of them and turns the wheel until the rest fired
+void bench_timer_wheel()
+{
+	const int count = 1000000;
+	executor pool(1);
+	timer_wheel timers(pool, std::chrono::milliseconds(1), timer_wheel::manual);
+	std::vector<timer_id> ids(count);
+	std::atomic<int> fired{0};
+	std::uint32_t seed = 12345;
+	auto start = clock_type::now();
+	for (int i = 0; i < count; i++) {
+		seed = seed * 1664525 + 1013904223;
+		ids[i] = timers.after(std::chrono::milliseconds(1 + (seed >> 16)), [&fired] { fired++; });
+	}
+	record("timer_wheel_1M", "schedule", elapsed_ns(start) / count);
+	start = clock_type::now();
+	for (int i = 0; i < count; i += 2) {
+		timers.cancel(ids[i]);
+	}
+	record("timer_wheel_1M", "cancel", elapsed_ns(start) / (count / 2));
+	start = clock_type::now();
+	timers.advance(1 << 16);
+	while (fired < count / 2) {
+		std::this_thread::yield();
+	}
+	record("timer_wheel_1M", "fire", elapsed_ns(start) / (count / 2));
+}
+
+int main(int argc, char ** argv)
+{
+	std::size_t n = 10000000;
+	bool json = false;
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "--json") == 0) {
+			json = true;
+		} else {
+			n = std::stoul(argv[i]);
+		}
+	}
+
+	using int_delegate = delegate<int(int)>;
+	auto call = [](const auto & f, int i) { return f(i); };
+
+	target object;
+	// captures more than std::function keeps without allocating
+	int a = 3, b = 4, c = 5, d = 6, e = 7, f = 8;
+	auto small_lambda = [a,b,c,d,e,f](int i) { return a * i + b + c * d + e * f; };
+	std::array<int,2*DELEGATE_STORE_SIZE> big{};
+	big[0] = 3;
+	auto large_lambda = [big](int i) { return big[0] * i + 4; };
+
+	bench<int (*)(int)>("function_pointer", n, [] { return &free_function; }, call);
+	bench<derived>("virtual_call", n, [] { return derived(); },
+			[](const derived & v, int i) { return static_cast<const base &>(v).call(i); });
+	bench<std::function<int(int)>>("std_function_small_lambda", n,
+			[&] { return std::function<int(int)>(small_lambda); }, call);
+	bench<std::function<int(int)>>("std_function_large_lambda", n,
+			[&] { return std::function<int(int)>(large_lambda); }, call);
+
+	bench<int_delegate>("delegate_from_function", n,
+			[] { return int_delegate::from<&free_function>(); }, call);
+	bench<int_delegate>("delegate_from_method", n,
+			[&] { return int_delegate::from<target,&target::method>(object); }, call);
+	bench<int_delegate>("delegate_member_pair", n,
+			[&] { return int_delegate(&object, &target::method); }, call);
+	bench<int_delegate>("delegate_small_lambda", n,
+			[&] { return int_delegate(small_lambda); }, call);
+	bench<int_delegate>("delegate_large_lambda", n,
+			[&] { return int_delegate(large_lambda); }, call);
+	bench<int_delegate>("make_delegate_lambda", n,
+			[&] { return make_delegate(small_lambda); }, call);
+	bench<int_delegate>("make_delegate_via_std_function", n,
+			[&] { return make_delegate(to_function(small_lambda)); }, call);
+
+	bench<int_delegate>("delegate_5_layered_aspects", n, [&] {
+		auto layered = make_delegate(small_lambda);
+		for (int i = 0; i < 5; i++) {
+			layered = pass_through_layer(layered);
+		}
+		return layered;
+	}, call);
+	bench<int_delegate>("delegate_5_woven_aspects", n, [&] {
+		return weave<pass_through,pass_through,pass_through,pass_through,pass_through>(small_lambda);
+	}, call);
+
+	auto unique = make_unique_delegate(small_lambda);
+	bench_invoke("unique_delegate_small_lambda", n, unique);
+	atomic_delegate<int(int)> slot(make_delegate(small_lambda));
+	bench_invoke("atomic_delegate", n, slot);
+	latency_histogram latencies;
+	auto timed_call = timed(latencies)(make_delegate(small_lambda));
+	bench_invoke("timed_delegate", n, timed_call);
+	{
+		// raw records to a stream that discards them, with rings large enough not to drop
+		std::ostream discard(nullptr);
+		log_sink sink(discard, log_sink::raw, 1 << 24);
+		auto logged_call = logged(sink, "small_lambda")(make_delegate(small_lambda));
+		bench_invoke("logged_delegate", n, logged_call);
+	}
+	{
+		tracer calls;
+		auto traced_call = traced(calls, "small_lambda")(make_delegate(small_lambda));
+		bench_invoke("traced_delegate_disabled", n, traced_call);
+		// every enabled call keeps a span, so record fewer of them
+		calls.enable();
+		bench_invoke("traced_delegate_enabled", n / 16, traced_call);
+	}
+	bench_executor(n);
+	bench_timer_wheel();
+	bench_json_decode(n / 10);
+	bench_json_scan(n / 10);
+	bench_function_lookup(n / 10);
+
+	if (json) {
+		std::printf("[\n");
+		for (std::size_t i = 0; i < results.size(); i++) {
+			std::printf("  {\"subject\": \"%s\", \"operation\": \"%s\", \"ns_per_op\": %.3f}%s\n",
+					results[i].subject.c_str(), results[i].operation.c_str(), results[i].ns_per_op,
+					i + 1 < results.size() ? "," : "");
+		}
+		std::printf("]\n");
+	} else {
+		std::printf("subject,operation,ns_per_op\n");
+		for (auto & r : results) {
+			std::printf("%s,%s,%.3f\n", r.subject.c_str(), r.operation.c_str(), r.ns_per_op);
+		}
+	}
+	return 0;
+}
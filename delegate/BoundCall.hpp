@@ -0,0 +1,83 @@
+#pragma once
+#include <libs/delegate/Delegate.hpp>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+//---------------------------------------------------------------------------------
+/// bound_call class
+/// a delegate and the arguments of a deferred call of it, stored by value.
+/// the arguments are a std::tuple<std::decay_t<A>...> member, like delegate::tuple(),
+/// so the size of a bound_call depends on its signature only and binding does not
+/// allocate unless the delegate or an argument does. a default constructed
+/// bound_call is empty, which makes it a slot type for rings and queues.
+///
+///		auto later = make_bound_call(make_delegate(&obj, &C::m), 9, std::string("abcd"));
+///		queue.push(std::move(later));
+///		...
+///		auto call = std::move(queue.front());
+///		queue.pop();
+///		auto r = call();
+//---------------------------------------------------------------------------------
+template <typename T> class bound_call;
+
+template <typename R, typename... A>
+class bound_call<R(A...)>
+{
+public:
+	using delegate_type = delegate<R(A...)>;
+	using arguments_type = std::tuple<std::decay_t<A>...>;
+
+	bound_call() = default;
+
+	template <typename... Args>
+	explicit bound_call(delegate_type f, Args &&... args)
+	:_f(std::move(f))
+	,_args(std::forward<Args>(args)...)
+	{
+		static_assert(sizeof...(Args) == sizeof...(A), "bound_call needs one value per argument");
+	}
+
+	bound_call(bound_call &&) = default;
+	bound_call & operator=(bound_call &&) = default;
+	bound_call(const bound_call &) = default;
+	bound_call & operator=(const bound_call &) = default;
+
+	/// calls the delegate, passing each argument as delegate_param_t of its type.
+	/// copyable arguments taken by value are copied, small trivially copyable ones
+	/// directly and others through a const reference, so they stay in the
+	/// bound_call. only move-only arguments taken by value and arguments taken by
+	/// rvalue reference are moved into the call, and a bound_call with such
+	/// arguments runs once.
+	R operator()() { return call(std::index_sequence_for<A...>()); }
+
+	explicit operator bool() const noexcept { return bool(_f); }
+
+	/// drops the delegate and the arguments
+	void reset()
+	{
+		_f.reset();
+		_args = arguments_type();
+	}
+
+	const delegate_type & function() const { return _f; }
+	arguments_type & arguments() { return _args; }
+	const arguments_type & arguments() const { return _args; }
+
+private:
+	template <std::size_t... I>
+	R call(std::index_sequence<I...>)
+	{
+		return _f(std::forward<delegate_param_t<A>>(std::get<I>(_args))...);
+	}
+
+	delegate_type _f;
+	arguments_type _args;
+};
+
+template <typename R, typename... A, typename... Args>
+bound_call<R(A...)> make_bound_call(delegate<R(A...)> f, Args &&... args)
+{
+	return bound_call<R(A...)>(std::move(f), std::forward<Args>(args)...);
+}
@@ -1,27 +1,69 @@
 #pragma once
+#include <atomic>
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <new>
+#include <stdexcept>
 #include <type_traits>
 #include <utility>
 #include <tuple>
 #include <iostream>
 
-
+/// size in bytes of the inline buffer a delegate uses to store small functors.
+/// functors that are larger (or over-aligned, or not nothrow-movable) are
+/// stored on the heap instead.
+#ifndef DELEGATE_STORE_SIZE
+#define DELEGATE_STORE_SIZE 48
+#endif
 
 //---------------------------------------------------------------------------------
 /// delegate class
 /// encapsulates a callable function and its arguments
 /// delegate::tuple() method returns a tuple matching the function's argument types
 /// delegate should be constructed using the make_delegate functions
+/// small functors (lambdas, member pairs) are kept in an inline buffer of
+/// DELEGATE_STORE_SIZE bytes, so wrapping them does not allocate
 /// from adapted from http://codereview.stackexchange.com/questions/14730/impossibly-fast-delegate-in-c11
 //---------------------------------------------------------------------------------
 template <typename T> class delegate;
 
+template <typename T> class unique_delegate;
+
+/// how a delegate passes an argument of type T on to its target.
+/// small trivially copyable types are passed by value, move-only types
+/// by rvalue reference and everything else by const reference, so large
+/// arguments are not copied on their way through a chain of delegates.
+template <typename T>
+struct delegate_param
+{
+  using type = typename ::std::conditional<
+    ::std::is_reference<T>{} ||
+      (::std::is_trivially_copyable<T>{} && sizeof(T) <= 2 * sizeof(void*)),
+    T,
+    typename ::std::conditional<
+      ::std::is_copy_constructible<T>{},
+      T const&,
+      T&&
+    >::type
+  >::type;
+};
+
+template <typename T>
+using delegate_param_t = typename delegate_param<T>::type;
+
+template <typename T>
+struct is_unique_delegate : ::std::false_type { };
+
+template <typename T>
+struct is_unique_delegate<unique_delegate<T> > : ::std::true_type { };
+
 template<class R, class ...A>
 class delegate<R (A...)>
 {
-  using stub_ptr_type = R (*)(void*, A&&...);
+  using stub_ptr_type = R (*)(void*, delegate_param_t<A>...);
 
 public:
   delegate(void* const o, stub_ptr_type const m) noexcept :
@@ -29,16 +71,80 @@ public:
     stub_ptr_(m)
   {
   }
-  static std::tuple<A...> tuple()
+  static std::tuple<typename std::decay<A>::type...> tuple()
   {
-	  return std::tuple<A...>();
+	  return std::tuple<typename std::decay<A>::type...>();
   }
 
   delegate() = default;
 
-  delegate(delegate const&) = default;
+  delegate(delegate const& other) :
+    object_ptr_(other.object_ptr_),
+    stub_ptr_(other.stub_ptr_),
+    manager_(other.manager_),
+    functor_id_(other.functor_id_),
+    cloner_(other.cloner_),
+    store_(other.store_)
+  {
+    if (manager_)
+    {
+      manager_(store_op::copy, &inline_store_,
+        const_cast<inline_store_type*>(&other.inline_store_));
+
+      object_ptr_ = &inline_store_;
+    }
+  }
+
+  delegate(delegate&& other) noexcept :
+    object_ptr_(other.object_ptr_),
+    stub_ptr_(other.stub_ptr_),
+    manager_(other.manager_),
+    functor_id_(other.functor_id_),
+    cloner_(other.cloner_),
+    store_(::std::move(other.store_))
+  {
+    if (manager_)
+    {
+      manager_(store_op::move, &inline_store_, &other.inline_store_);
+
+      object_ptr_ = &inline_store_;
+    }
+  }
+
+  /// takes over the functor owned by a unique_delegate.
+  /// inline functors are moved, heap functors are adopted without copying.
+  explicit delegate(unique_delegate<R (A...)>&& other) :
+    object_ptr_(other.object_ptr_),
+    stub_ptr_(other.stub_ptr_),
+    manager_(other.manager_)
+  {
+    if (manager_)
+    {
+      manager_(store_op::move, &inline_store_, &other.inline_store_);
+
+      object_ptr_ = &inline_store_;
+
+      functor_id_ = next_functor_id();
+    }
+    else if (other.deleter_)
+    {
+      // other gives the functor up first: if reset() throws, the deleter
+      // has destroyed it and other must not destroy it again
+      auto const deleter = other.deleter_;
+
+      other.deleter_ = nullptr;
+
+      store_.reset(other.object_ptr_, deleter);
+
+      cloner_ = other.cloner_;
 
-  delegate(delegate&&) = default;
+      functor_id_ = next_functor_id();
+    }
+
+    other.reset();
+  }
+
+  ~delegate() { destroy_inline(); }
 
   delegate(::std::nullptr_t const) noexcept : delegate() { }
 
@@ -59,52 +165,80 @@ public:
   template <class C>
   delegate(C* const object_ptr, R (C::* const method_ptr)(A...))
   {
-    *this = from(object_ptr, method_ptr);
+    store(member_pair<C>(object_ptr, method_ptr));
   }
 
   template <class C>
   delegate(C* const object_ptr, R (C::* const method_ptr)(A...) const)
   {
-    *this = from(object_ptr, method_ptr);
+    store(const_member_pair<C>(object_ptr, method_ptr));
   }
 
   template <class C>
   delegate(C& object, R (C::* const method_ptr)(A...))
   {
-    *this = from(object, method_ptr);
+    store(member_pair<C>(&object, method_ptr));
   }
 
   template <class C>
   delegate(C const& object, R (C::* const method_ptr)(A...) const)
   {
-    *this = from(object, method_ptr);
+    store(const_member_pair<C>(&object, method_ptr));
   }
 
   template <
     typename T,
     typename = typename ::std::enable_if<
-      !::std::is_same<delegate, typename ::std::decay<T>::type>{}
+      !::std::is_same<delegate, typename ::std::decay<T>::type>{} &&
+      !is_unique_delegate<typename ::std::decay<T>::type>{}
     >::type
   >
-  delegate(T&& f) :
-    store_(operator new(sizeof(typename ::std::decay<T>::type)),
-      functor_deleter<typename ::std::decay<T>::type>),
-    store_size_(sizeof(typename ::std::decay<T>::type))
+  delegate(T&& f)
   {
-    using functor_type = typename ::std::decay<T>::type;
-
-    new (store_.get()) functor_type(::std::forward<T>(f));
+    store(::std::forward<T>(f));
+  }
 
-    object_ptr_ = store_.get();
+  /// stores f like delegate(T&&), but allocates it from alloc when it does
+  /// not fit inline, e.g. from a per-request monotonic_arena
+  template <typename Alloc, typename T>
+  delegate(::std::allocator_arg_t, Alloc const& alloc, T&& f)
+  {
+    store(::std::forward<T>(f), alloc);
+  }
 
-    stub_ptr_ = functor_stub<functor_type>;
+  delegate& operator=(delegate const& rhs)
+  {
+    if (this != &rhs)
+    {
+      *this = delegate(rhs);
+    }
 
-    deleter_ = deleter_stub<functor_type>;
+    return *this;
   }
 
-  delegate& operator=(delegate const&) = default;
+  delegate& operator=(delegate&& rhs) noexcept
+  {
+    if (this != &rhs)
+    {
+      destroy_inline();
 
-  delegate& operator=(delegate&&) = default;
+      object_ptr_ = rhs.object_ptr_;
+      stub_ptr_ = rhs.stub_ptr_;
+      manager_ = rhs.manager_;
+      functor_id_ = rhs.functor_id_;
+      cloner_ = rhs.cloner_;
+      store_ = ::std::move(rhs.store_);
+
+      if (manager_)
+      {
+        manager_(store_op::move, &inline_store_, &rhs.inline_store_);
+
+        object_ptr_ = &inline_store_;
+      }
+    }
+
+    return *this;
+  }
 
   template <class C>
   delegate& operator=(R (C::* const rhs)(A...))
@@ -121,34 +255,14 @@ public:
   template <
     typename T,
     typename = typename ::std::enable_if<
-      !::std::is_same<delegate, typename ::std::decay<T>::type>{}
+      !::std::is_same<delegate, typename ::std::decay<T>::type>{} &&
+      !is_unique_delegate<typename ::std::decay<T>::type>{}
     >::type
   >
   delegate& operator=(T&& f)
   {
-    using functor_type = typename ::std::decay<T>::type;
-
-    if ((sizeof(functor_type) > store_size_) || !store_.unique())
-    {
-      store_.reset(operator new(sizeof(functor_type)),
-        functor_deleter<functor_type>);
-
-      store_size_ = sizeof(functor_type);
-    }
-    else
-    {
-      deleter_(store_.get());
-    }
-
-    new (store_.get()) functor_type(::std::forward<T>(f));
-
-    object_ptr_ = store_.get();
-
-    stub_ptr_ = functor_stub<functor_type>;
-
-    deleter_ = deleter_stub<functor_type>;
-
-    return *this;
+    // built aside, so a throwing constructor leaves this delegate as it was
+    return *this = delegate(::std::forward<T>(f));
   }
 
   template <R (* const function_ptr)(A...)>
@@ -227,15 +341,29 @@ public:
     return const_member_pair<C>(&object, method_ptr);
   }
 
-  void reset() { stub_ptr_ = nullptr; store_.reset(); }
+  /// true if functors of type T are kept in the inline buffer
+  template <typename T>
+  static constexpr bool stored_inline() noexcept
+  {
+    return (sizeof(T) <= sizeof(inline_store_type)) &&
+      (alignof(T) <= alignof(inline_store_type)) &&
+      ::std::is_nothrow_move_constructible<T>{} &&
+      ::std::is_copy_constructible<T>{};
+  }
+
+  void reset() { stub_ptr_ = nullptr; destroy_inline(); functor_id_ = 0; cloner_ = nullptr; store_.reset(); }
 
   void reset_stub() noexcept { stub_ptr_ = nullptr; }
 
   void swap(delegate& other) noexcept { ::std::swap(*this, other); }
 
+  /// delegates are equal when they call the same object, or when one is a
+  /// copy of the other: a stored functor is identified by the delegate that
+  /// stored it, not by its address, which differs for every inline copy.
+  /// two delegates storing equal functors separately are not equal.
   bool operator==(delegate const& rhs) const noexcept
   {
-    return (object_ptr_ == rhs.object_ptr_) && (stub_ptr_ == rhs.stub_ptr_);
+    return (identity() == rhs.identity()) && (stub_ptr_ == rhs.stub_ptr_);
   }
 
   bool operator!=(delegate const& rhs) const noexcept
@@ -245,8 +373,8 @@ public:
 
   bool operator<(delegate const& rhs) const noexcept
   {
-    return (object_ptr_ < rhs.object_ptr_) ||
-      ((object_ptr_ == rhs.object_ptr_) && (stub_ptr_ < rhs.stub_ptr_));
+    return (identity() < rhs.identity()) ||
+      ((identity() == rhs.identity()) && (stub_ptr_ < rhs.stub_ptr_));
   }
 
   bool operator==(::std::nullptr_t const) const noexcept
@@ -261,25 +389,168 @@ public:
 
   explicit operator bool() const noexcept { return stub_ptr_; }
 
-  R operator()(A... args) const
+  R operator()(delegate_param_t<A>... args) const
   {
 //  assert(stub_ptr);
-    return stub_ptr_(object_ptr_, ::std::forward<A>(args)...);
+    return stub_ptr_(object_ptr_, ::std::forward<delegate_param_t<A>>(args)...);
   }
 
 
 private:
   friend struct ::std::hash<delegate>;
 
+  friend class unique_delegate<R (A...)>;
+
+  template <typename> friend class multicast_delegate;
+
   using deleter_type = void (*)(void*);
 
+  enum class store_op { copy, move, destroy };
+
+  using manager_type = void (*)(store_op, void*, void*);
+
+  // copies (or moves) a heap functor into a new allocation owned by the
+  // caller, and sets the deleter that frees it
+  using cloner_type = void* (*)(void*, bool, deleter_type&);
+
+  using inline_store_type = typename ::std::aligned_storage<
+    DELEGATE_STORE_SIZE, alignof(::std::max_align_t)>::type;
+
   void* object_ptr_;
   stub_ptr_type stub_ptr_{};
 
-  deleter_type deleter_;
+  // non-null while a functor lives in inline_store_
+  manager_type manager_{};
+
+  // non-zero while the delegate stores a functor, shared by its copies
+  ::std::uint64_t functor_id_{};
+
+  // non-null while a functor lives in store_
+  cloner_type cloner_{};
 
   ::std::shared_ptr<void> store_;
-  ::std::size_t store_size_;
+
+  inline_store_type inline_store_;
+
+  // what operator==, operator< and std::hash compare besides the stub:
+  // the functor id of a stored functor, otherwise the object called
+  ::std::pair< ::std::uint64_t, void*> identity() const noexcept
+  {
+    return functor_id_ ?
+      ::std::pair< ::std::uint64_t, void*>(functor_id_, nullptr) :
+      ::std::pair< ::std::uint64_t, void*>(0, object_ptr_);
+  }
+
+  // ids come from a shared counter in blocks, so a thread numbers the
+  // functors it stores without an atomic operation
+  static ::std::uint64_t next_functor_id() noexcept
+  {
+    static ::std::atomic< ::std::uint64_t> blocks{1};
+
+    static thread_local ::std::uint64_t next, end;
+
+    if (next == end)
+    {
+      next = blocks.fetch_add(functor_id_block, ::std::memory_order_relaxed);
+
+      end = next + functor_id_block;
+    }
+
+    return next++;
+  }
+
+  static constexpr ::std::uint64_t functor_id_block = 1 << 16;
+
+  template <typename T, typename Alloc = ::std::allocator<char> >
+  typename ::std::enable_if<
+    stored_inline<typename ::std::decay<T>::type>()
+  >::type
+  store(T&& f, Alloc const& = Alloc())
+  {
+    using functor_type = typename ::std::decay<T>::type;
+
+    new (&inline_store_) functor_type(::std::forward<T>(f));
+
+    store_.reset();
+
+    object_ptr_ = &inline_store_;
+
+    stub_ptr_ = functor_stub<functor_type>;
+
+    manager_ = manager_stub<functor_type>;
+
+    functor_id_ = next_functor_id();
+  }
+
+  // functors that do not fit inline are allocated from alloc and shared
+  // by copies of the delegate. the control block comes from alloc too.
+  template <typename T, typename Alloc = ::std::allocator<char> >
+  typename ::std::enable_if<
+    !stored_inline<typename ::std::decay<T>::type>()
+  >::type
+  store(T&& f, Alloc const& alloc = Alloc())
+  {
+    using functor_type = typename ::std::decay<T>::type;
+
+    using allocator_type = typename ::std::allocator_traits<Alloc>::
+      template rebind_alloc<functor_type>;
+
+    using traits = ::std::allocator_traits<allocator_type>;
+
+    allocator_type a(alloc);
+
+    auto const p = traits::allocate(a, 1);
+
+    try
+    {
+      traits::construct(a, p, ::std::forward<T>(f));
+    }
+    catch (...)
+    {
+      traits::deallocate(a, p, 1);
+
+      throw;
+    }
+
+    store_.reset(p, allocator_deleter<allocator_type>{ a }, a);
+
+    object_ptr_ = p;
+
+    stub_ptr_ = functor_stub<functor_type>;
+
+    functor_id_ = next_functor_id();
+
+    cloner_ = clone_stub<functor_type>;
+  }
+
+  void destroy_inline() noexcept
+  {
+    if (manager_)
+    {
+      manager_(store_op::destroy, &inline_store_, nullptr);
+
+      manager_ = nullptr;
+    }
+  }
+
+  template <class T>
+  static void manager_stub(store_op const op, void* const dst, void* const src)
+  {
+    switch (op)
+    {
+      case store_op::copy:
+        new (dst) T(*static_cast<T const*>(src));
+        break;
+
+      case store_op::move:
+        new (dst) T(::std::move(*static_cast<T*>(src)));
+        break;
+
+      case store_op::destroy:
+        static_cast<T*>(dst)->~T();
+        break;
+    }
+  }
 
   template <class T>
   static void functor_deleter(void* const p)
@@ -290,29 +561,76 @@ private:
   }
 
   template <class T>
-  static void deleter_stub(void* const p)
+  static void* clone_stub(void* const p, bool const move, deleter_type& deleter)
   {
-    static_cast<T*>(p)->~T();
+    ::std::unique_ptr<void, void (*)(void*)> q(
+      operator new(sizeof(T)), operator delete);
+
+    construct_clone<T>(q.get(), static_cast<T*>(p), move,
+      ::std::is_copy_constructible<T>{});
+
+    deleter = functor_deleter<T>;
+
+    return q.release();
+  }
+
+  template <class T>
+  static void construct_clone(void* const q, T* const p, bool const move,
+    ::std::true_type)
+  {
+    if (move)
+    {
+      new (q) T(::std::move(*p));
+    }
+    else
+    {
+      new (q) T(*p);
+    }
+  }
+
+  template <class T>
+  static void construct_clone(void* const q, T* const p, bool const move,
+    ::std::false_type)
+  {
+    if (!move)
+    {
+      throw ::std::logic_error("a shared move-only functor cannot be owned exclusively");
+    }
+
+    new (q) T(::std::move(*p));
   }
 
+  template <class Alloc>
+  struct allocator_deleter
+  {
+    Alloc alloc;
+
+    void operator()(typename ::std::allocator_traits<Alloc>::pointer const p)
+    {
+      ::std::allocator_traits<Alloc>::destroy(alloc, p);
+
+      ::std::allocator_traits<Alloc>::deallocate(alloc, p, 1);
+    }
+  };
+
   template <R (*function_ptr)(A...)>
-  static R function_stub(void* const, A&&... args)
+  static R function_stub(void* const, delegate_param_t<A>... args)
   {
-    return function_ptr(::std::forward<A>(args)...);
+    return function_ptr(::std::forward<delegate_param_t<A>>(args)...);
   }
 
   template <class C, R (C::*method_ptr)(A...)>
-  static R method_stub(void* const object_ptr, A&&... args)
+  static R method_stub(void* const object_ptr, delegate_param_t<A>... args)
   {
     return (static_cast<C*>(object_ptr)->*method_ptr)(
-      ::std::forward<A>(args)...);
+      ::std::forward<delegate_param_t<A>>(args)...);
   }
 
   template <class C, R (C::*method_ptr)(A...) const>
-  static R const_method_stub(void* const object_ptr, A&&... args)
+  static R const_method_stub(void* const object_ptr, delegate_param_t<A>... args)
   {
     return (static_cast<C const*>(object_ptr)->*method_ptr)(
-      ::std::forward<A>(args)...);
+      ::std::forward<delegate_param_t<A>>(args)...);
   }
 
   template <typename>
@@ -339,9 +657,9 @@ private:
     is_const_member_pair<T>{}),
     R
   >::type
-  functor_stub(void* const object_ptr, A&&... args)
+  functor_stub(void* const object_ptr, delegate_param_t<A>... args)
   {
-    return (*static_cast<T*>(object_ptr))(::std::forward<A>(args)...);
+    return (*static_cast<T*>(object_ptr))(::std::forward<delegate_param_t<A>>(args)...);
   }
 
   template <typename T>
@@ -350,10 +668,379 @@ private:
     is_const_member_pair<T>{},
     R
   >::type
-  functor_stub(void* const object_ptr, A&&... args)
+  functor_stub(void* const object_ptr, delegate_param_t<A>... args)
   {
     return (static_cast<T*>(object_ptr)->first->*
-      static_cast<T*>(object_ptr)->second)(::std::forward<A>(args)...);
+      static_cast<T*>(object_ptr)->second)(::std::forward<delegate_param_t<A>>(args)...);
+  }
+};
+
+//---------------------------------------------------------------------------------
+/// unique_delegate class
+/// move-only sibling of delegate that owns its functor exclusively.
+/// moving or destroying a unique_delegate never touches an atomic reference
+/// count, which keeps hot paths from bouncing the count between cores.
+/// small functors are stored inline exactly like in delegate, larger (or
+/// move-only) functors are allocated once and owned without a control block.
+/// converting to and from delegate is explicit and moves the functor, or
+/// copies it when other delegates still share it.
+//---------------------------------------------------------------------------------
+template<class R, class ...A>
+class unique_delegate<R (A...)>
+{
+  using delegate_type = delegate<R (A...)>;
+
+  using stub_ptr_type = typename delegate_type::stub_ptr_type;
+
+public:
+  unique_delegate(void* const o, stub_ptr_type const m) noexcept :
+    object_ptr_(o),
+    stub_ptr_(m)
+  {
+  }
+
+  static std::tuple<typename std::decay<A>::type...> tuple()
+  {
+	  return std::tuple<typename std::decay<A>::type...>();
+  }
+
+  unique_delegate() = default;
+
+  unique_delegate(unique_delegate const&) = delete;
+
+  unique_delegate(unique_delegate&& other) noexcept :
+    object_ptr_(other.object_ptr_),
+    stub_ptr_(other.stub_ptr_),
+    manager_(other.manager_),
+    deleter_(other.deleter_),
+    cloner_(other.cloner_)
+  {
+    if (manager_)
+    {
+      manager_(store_op::move, &inline_store_, &other.inline_store_);
+
+      object_ptr_ = &inline_store_;
+    }
+
+    other.deleter_ = nullptr;
+
+    other.reset();
+  }
+
+  unique_delegate(::std::nullptr_t const) noexcept : unique_delegate() { }
+
+  /// copies the functor of a delegate.
+  /// a heap functor is copied into an allocation of its own; a move-only
+  /// one throws std::logic_error, since the delegate keeps sharing it.
+  explicit unique_delegate(delegate_type const& other) :
+    object_ptr_(other.object_ptr_),
+    stub_ptr_(other.stub_ptr_),
+    manager_(other.manager_)
+  {
+    if (manager_)
+    {
+      manager_(store_op::copy, &inline_store_,
+        const_cast<inline_store_type*>(&other.inline_store_));
+
+      object_ptr_ = &inline_store_;
+    }
+    else if (other.cloner_)
+    {
+      object_ptr_ = other.cloner_(other.object_ptr_, false, deleter_);
+
+      cloner_ = other.cloner_;
+    }
+  }
+
+  /// moves the functor out of a delegate.
+  /// a heap functor is moved into an allocation of its own when no other
+  /// delegate shares it, otherwise it is copied as by the constructor above.
+  explicit unique_delegate(delegate_type&& other) :
+    object_ptr_(other.object_ptr_),
+    stub_ptr_(other.stub_ptr_),
+    manager_(other.manager_)
+  {
+    if (manager_)
+    {
+      manager_(store_op::move, &inline_store_, &other.inline_store_);
+
+      object_ptr_ = &inline_store_;
+    }
+    else if (other.cloner_)
+    {
+      object_ptr_ = other.cloner_(other.object_ptr_,
+        other.store_.use_count() == 1, deleter_);
+
+      cloner_ = other.cloner_;
+    }
+
+    other.reset();
+  }
+
+  template <class C>
+  unique_delegate(C* const object_ptr, R (C::* const method_ptr)(A...))
+  {
+    store(typename delegate_type::template member_pair<C>(object_ptr,
+      method_ptr));
+  }
+
+  template <class C>
+  unique_delegate(C* const object_ptr, R (C::* const method_ptr)(A...) const)
+  {
+    store(typename delegate_type::template const_member_pair<C>(object_ptr,
+      method_ptr));
+  }
+
+  template <class C>
+  unique_delegate(C& object, R (C::* const method_ptr)(A...))
+  {
+    store(typename delegate_type::template member_pair<C>(&object,
+      method_ptr));
+  }
+
+  template <class C>
+  unique_delegate(C const& object, R (C::* const method_ptr)(A...) const)
+  {
+    store(typename delegate_type::template const_member_pair<C>(&object,
+      method_ptr));
+  }
+
+  template <
+    typename T,
+    typename = typename ::std::enable_if<
+      !::std::is_same<unique_delegate, typename ::std::decay<T>::type>{} &&
+      !::std::is_same<delegate_type, typename ::std::decay<T>::type>{}
+    >::type
+  >
+  unique_delegate(T&& f)
+  {
+    store(::std::forward<T>(f));
+  }
+
+  ~unique_delegate() { release(); }
+
+  unique_delegate& operator=(unique_delegate const&) = delete;
+
+  unique_delegate& operator=(unique_delegate&& rhs) noexcept
+  {
+    if (this != &rhs)
+    {
+      release();
+
+      object_ptr_ = rhs.object_ptr_;
+      stub_ptr_ = rhs.stub_ptr_;
+      manager_ = rhs.manager_;
+      deleter_ = rhs.deleter_;
+      cloner_ = rhs.cloner_;
+
+      if (manager_)
+      {
+        manager_(store_op::move, &inline_store_, &rhs.inline_store_);
+
+        object_ptr_ = &inline_store_;
+      }
+
+      rhs.deleter_ = nullptr;
+
+      rhs.reset();
+    }
+
+    return *this;
+  }
+
+  template <
+    typename T,
+    typename = typename ::std::enable_if<
+      !::std::is_same<unique_delegate, typename ::std::decay<T>::type>{} &&
+      !::std::is_same<delegate_type, typename ::std::decay<T>::type>{}
+    >::type
+  >
+  unique_delegate& operator=(T&& f)
+  {
+    return *this = unique_delegate(::std::forward<T>(f));
+  }
+
+  template <R (* const function_ptr)(A...)>
+  static unique_delegate from() noexcept
+  {
+    return { nullptr, delegate_type::template function_stub<function_ptr> };
+  }
+
+  template <class C, R (C::* const method_ptr)(A...)>
+  static unique_delegate from(C* const object_ptr) noexcept
+  {
+    return { object_ptr, delegate_type::template method_stub<C, method_ptr> };
+  }
+
+  template <class C, R (C::* const method_ptr)(A...) const>
+  static unique_delegate from(C const* const object_ptr) noexcept
+  {
+    return { const_cast<C*>(object_ptr),
+      delegate_type::template const_method_stub<C, method_ptr> };
+  }
+
+  template <class C, R (C::* const method_ptr)(A...)>
+  static unique_delegate from(C& object) noexcept
+  {
+    return { &object, delegate_type::template method_stub<C, method_ptr> };
+  }
+
+  template <class C, R (C::* const method_ptr)(A...) const>
+  static unique_delegate from(C const& object) noexcept
+  {
+    return { const_cast<C*>(&object),
+      delegate_type::template const_method_stub<C, method_ptr> };
+  }
+
+  template <typename T>
+  static unique_delegate from(T&& f)
+  {
+    return unique_delegate(::std::forward<T>(f));
+  }
+
+  static unique_delegate from(R (* const function_ptr)(A...))
+  {
+    return function_ptr;
+  }
+
+  template <class C>
+  static unique_delegate from(C* const object_ptr,
+    R (C::* const method_ptr)(A...))
+  {
+    return { object_ptr, method_ptr };
+  }
+
+  template <class C>
+  static unique_delegate from(C const* const object_ptr,
+    R (C::* const method_ptr)(A...) const)
+  {
+    return { object_ptr, method_ptr };
+  }
+
+  template <class C>
+  static unique_delegate from(C& object, R (C::* const method_ptr)(A...))
+  {
+    return { object, method_ptr };
+  }
+
+  template <class C>
+  static unique_delegate from(C const& object,
+    R (C::* const method_ptr)(A...) const)
+  {
+    return { object, method_ptr };
+  }
+
+  void reset() noexcept
+  {
+    release();
+
+    object_ptr_ = nullptr;
+
+    stub_ptr_ = nullptr;
+  }
+
+  void swap(unique_delegate& other) noexcept { ::std::swap(*this, other); }
+
+  bool operator==(::std::nullptr_t const) const noexcept
+  {
+    return !stub_ptr_;
+  }
+
+  bool operator!=(::std::nullptr_t const) const noexcept
+  {
+    return stub_ptr_;
+  }
+
+  explicit operator bool() const noexcept { return stub_ptr_; }
+
+  R operator()(delegate_param_t<A>... args) const
+  {
+//  assert(stub_ptr);
+    return stub_ptr_(object_ptr_, ::std::forward<delegate_param_t<A>>(args)...);
+  }
+
+private:
+  friend class delegate<R (A...)>;
+
+  using store_op = typename delegate_type::store_op;
+
+  using manager_type = typename delegate_type::manager_type;
+
+  using deleter_type = typename delegate_type::deleter_type;
+
+  using cloner_type = typename delegate_type::cloner_type;
+
+  using inline_store_type = typename delegate_type::inline_store_type;
+
+  void* object_ptr_{};
+  stub_ptr_type stub_ptr_{};
+
+  // non-null while a functor lives in inline_store_
+  manager_type manager_{};
+
+  // non-null while this unique_delegate owns a heap functor
+  deleter_type deleter_{};
+
+  // copies the heap functor when it is handed to a delegate and back
+  cloner_type cloner_{};
+
+  inline_store_type inline_store_;
+
+  template <typename T>
+  typename ::std::enable_if<
+    delegate_type::template stored_inline<typename ::std::decay<T>::type>()
+  >::type
+  store(T&& f)
+  {
+    using functor_type = typename ::std::decay<T>::type;
+
+    new (&inline_store_) functor_type(::std::forward<T>(f));
+
+    object_ptr_ = &inline_store_;
+
+    stub_ptr_ = delegate_type::template functor_stub<functor_type>;
+
+    manager_ = delegate_type::template manager_stub<functor_type>;
+  }
+
+  template <typename T>
+  typename ::std::enable_if<
+    !delegate_type::template stored_inline<typename ::std::decay<T>::type>()
+  >::type
+  store(T&& f)
+  {
+    using functor_type = typename ::std::decay<T>::type;
+
+    ::std::unique_ptr<void, void (*)(void*)> p(
+      operator new(sizeof(functor_type)), operator delete);
+
+    new (p.get()) functor_type(::std::forward<T>(f));
+
+    object_ptr_ = p.release();
+
+    stub_ptr_ = delegate_type::template functor_stub<functor_type>;
+
+    deleter_ = delegate_type::template functor_deleter<functor_type>;
+
+    cloner_ = delegate_type::template clone_stub<functor_type>;
+  }
+
+  void release() noexcept
+  {
+    if (manager_)
+    {
+      manager_(store_op::destroy, &inline_store_, nullptr);
+
+      manager_ = nullptr;
+    }
+    else if (deleter_)
+    {
+      deleter_(object_ptr_);
+    }
+
+    deleter_ = nullptr;
+
+    cloner_ = nullptr;
   }
 };
 
@@ -364,7 +1051,10 @@ namespace std
   {
     size_t operator()(::delegate<R (A...)> const& d) const noexcept
     {
-      auto const seed(hash<void*>()(d.object_ptr_));
+      auto const identity(d.identity());
+
+      auto const seed(hash< ::std::uint64_t>()(identity.first) ^
+        hash<void*>()(identity.second));
 
       return hash<typename ::delegate<R (A...)>::stub_ptr_type>()(
         d.stub_ptr_) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
@@ -428,8 +1118,34 @@ struct function_traits<ReturnType(ClassType::*)(Args...) const>
 {
 	typedef ReturnType (*pointer)(Args...);
 	typedef std::function<ReturnType(Args...)> function;
+	typedef ReturnType signature(Args...);
+};
+
+template <typename ReturnType, typename... Args>
+struct function_traits<ReturnType(*)(Args...)>
+{
+	typedef ReturnType (*pointer)(Args...);
+	typedef std::function<ReturnType(Args...)> function;
+	typedef ReturnType signature(Args...);
 };
 
+// mutable lambdas have a non-const call operator
+template <typename ClassType, typename ReturnType, typename... Args>
+struct function_traits<ReturnType(ClassType::*)(Args...)>
+: public function_traits<ReturnType(ClassType::*)(Args...) const>
+{};
+
+// delegates pass arguments as delegate_param_t, take the declared signature
+template <typename ReturnType, typename... Args>
+struct function_traits<delegate<ReturnType(Args...)> >
+: public function_traits<ReturnType(delegate<ReturnType(Args...)>::*)(Args...) const>
+{};
+
+template <typename ReturnType, typename... Args>
+struct function_traits<unique_delegate<ReturnType(Args...)> >
+: public function_traits<ReturnType(unique_delegate<ReturnType(Args...)>::*)(Args...) const>
+{};
+
 template <typename Function>
 typename function_traits<Function>::function
 to_function (Function& lambda)
@@ -437,12 +1153,50 @@ to_function (Function& lambda)
 	return static_cast<typename function_traits<Function>::function>(lambda);
 }
 
+/**
+ * function to deduce template parameters from a lambda or functor.
+ * the closure is stored in the delegate as is, function_traits only
+ * provides the signature, so calls go through a single stub.
+ */
 template <class F>
 auto make_delegate(F const & func )
 {
-	// convert lambda to std::function
-    return make_delegate(to_function(func));
+    return delegate<typename function_traits<F>::signature>::from(func);
 }
 
 
 
+
+/**
+ * unique_delegate counterparts of the make_delegate functions
+ */
+template <typename C, typename R, typename... A>
+unique_delegate<R(A...)> make_unique_delegate(C* const object_ptr, R (C::* const method_ptr)(A...))
+{
+    return unique_delegate<R(A...)>(object_ptr,method_ptr);
+}
+
+template <typename C, typename R, typename... A>
+unique_delegate<R(A...)> make_unique_delegate(C* const object_ptr, R (C::* const method_ptr)(A...) const)
+{
+    return unique_delegate<R(A...)>(object_ptr,method_ptr);
+}
+
+template <class R, class... Args>
+unique_delegate<R(Args...)> make_unique_delegate(R(*func)(Args...))
+{
+    return unique_delegate<R(Args...)>(func);
+}
+
+template <class R, class... Args>
+unique_delegate<R(Args...)> make_unique_delegate(std::function<R(Args...)> func )
+{
+    return unique_delegate<R(Args...)>(std::move(func));
+}
+
+template <class F>
+auto make_unique_delegate(F && func )
+{
+    using functor_type = typename std::decay<F>::type;
+    return unique_delegate<typename function_traits<functor_type>::signature>(std::forward<F>(func));
+}
@@ -0,0 +1,222 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+//---------------------------------------------------------------------------------
+/// epoch based reclamation
+/// lets lock-free writers retire objects that concurrent readers may still be using.
+/// a reader marks its critical section with an epoch_guard, and a retired object
+/// is deleted once every reader that could have seen it has left its section.
+/// entering a section is a plain store of the current epoch to a thread-local
+/// record: the store-load fence it would otherwise need is issued on the reader's
+/// behalf by the reclaiming thread through membarrier(2). when membarrier is not
+/// available the reader issues the fence itself.
+//---------------------------------------------------------------------------------
+namespace epoch_detail {
+
+	struct reader
+	{
+		std::atomic<std::uint64_t> epoch{0};	// 0 while outside a critical section
+		std::atomic<bool> in_use{true};
+		reader * next{nullptr};
+		unsigned depth{0};						// only touched by the owning thread
+	};
+
+	struct retired
+	{
+		void * object;
+		void (*deleter)(void *);
+		std::uint64_t epoch;
+		retired * next;
+	};
+
+	struct domain
+	{
+		domain()
+		:asymmetric(syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0)
+		{}
+
+		// runs at exit, when no reader is left
+		~domain()
+		{
+			for (auto r = retired_list.load(); r; ) {
+				auto next = r->next;
+				r->deleter(r->object);
+				delete r;
+				r = next;
+			}
+		}
+
+		std::atomic<std::uint64_t> global{1};
+		std::atomic<reader *> readers{nullptr};
+		std::atomic<retired *> retired_list{nullptr};
+		std::atomic_flag reclaiming = ATOMIC_FLAG_INIT;
+		const bool asymmetric;
+	};
+
+	inline domain & global_domain()
+	{
+		static domain d;
+		return d;
+	}
+
+	// claim a free reader record or add a new one. records are never deleted.
+	inline reader * claim_reader()
+	{
+		auto & d = global_domain();
+		for (auto r = d.readers.load(std::memory_order_acquire); r; r = r->next) {
+			bool expected = false;
+			if (!r->in_use.load(std::memory_order_relaxed)
+					&& r->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+				return r;
+			}
+		}
+		auto r = new reader();
+		r->next = d.readers.load(std::memory_order_relaxed);
+		while (!d.readers.compare_exchange_weak(r->next, r, std::memory_order_release, std::memory_order_relaxed)) {}
+		return r;
+	}
+
+	// the calling thread's reader record, released when the thread exits
+	struct reader_handle
+	{
+		reader_handle() :record(claim_reader()) {}
+		~reader_handle()
+		{
+			record->epoch.store(0, std::memory_order_release);
+			record->in_use.store(false, std::memory_order_release);
+		}
+		reader * record;
+	};
+
+	inline reader & claim_this_reader()
+	{
+		static thread_local reader_handle handle;
+		return *handle.record;
+	}
+
+	// the record is cached in a trivially initialized thread_local, which is
+	// read without the initialization check of the handle above
+	inline reader & this_reader()
+	{
+		static thread_local reader * cached = nullptr;
+		if (__builtin_expect(!cached, 0)) {
+			cached = &claim_this_reader();
+		}
+		return *cached;
+	}
+
+	// full fence on every thread of the process
+	inline void heavy_fence()
+	{
+		if (global_domain().asymmetric) {
+			syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+		} else {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+		}
+	}
+
+	inline void push(retired * first, retired * last)
+	{
+		auto & d = global_domain();
+		last->next = d.retired_list.load(std::memory_order_relaxed);
+		while (!d.retired_list.compare_exchange_weak(last->next, first, std::memory_order_release, std::memory_order_relaxed)) {}
+	}
+}
+
+/// marks a read-side critical section.
+/// objects loaded inside the section stay alive until it ends. may be nested.
+class epoch_guard
+{
+public:
+	epoch_guard() :_reader(epoch_detail::this_reader())
+	{
+		if (_reader.depth++ == 0) {
+			auto & d = epoch_detail::global_domain();
+			_reader.epoch.store(d.global.load(std::memory_order_acquire), std::memory_order_relaxed);
+			if (d.asymmetric) {
+				std::atomic_signal_fence(std::memory_order_seq_cst);
+			} else {
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+			}
+		}
+	}
+
+	~epoch_guard()
+	{
+		if (--_reader.depth == 0) {
+			_reader.epoch.store(0, std::memory_order_release);
+		}
+	}
+
+	epoch_guard(const epoch_guard &) = delete;
+	epoch_guard & operator=(const epoch_guard &) = delete;
+
+private:
+	epoch_detail::reader & _reader;
+};
+
+/// delete the retired objects no reader can still be using.
+/// never blocks: returns immediately if another thread is reclaiming.
+inline void epoch_reclaim()
+{
+	auto & d = epoch_detail::global_domain();
+	if (d.reclaiming.test_and_set(std::memory_order_acquire)) {
+		return;
+	}
+
+	auto list = d.retired_list.exchange(nullptr, std::memory_order_acquire);
+	if (list) {
+		epoch_detail::heavy_fence();
+
+		// objects retired before the oldest active epoch are unreachable
+		auto oldest = std::numeric_limits<std::uint64_t>::max();
+		for (auto r = d.readers.load(std::memory_order_acquire); r; r = r->next) {
+			auto e = r->epoch.load(std::memory_order_acquire);
+			if (e && e < oldest) {
+				oldest = e;
+			}
+		}
+
+		epoch_detail::retired * first = nullptr, * last = nullptr;
+		while (list) {
+			auto next = list->next;
+			if (list->epoch < oldest) {
+				list->deleter(list->object);
+				delete list;
+			} else {
+				list->next = first;
+				first = list;
+				if (!last) {
+					last = list;
+				}
+			}
+			list = next;
+		}
+		if (first) {
+			epoch_detail::push(first, last);
+		}
+	}
+
+	d.reclaiming.clear(std::memory_order_release);
+}
+
+/// hand over an object that new readers can no longer reach.
+/// it is deleted once readers that may have loaded it are done.
+template <typename T>
+void epoch_retire(T * object)
+{
+	if (!object) {
+		return;
+	}
+	auto & d = epoch_detail::global_domain();
+	auto r = new epoch_detail::retired{object, [](void * p) { delete static_cast<T *>(p); }, 0, nullptr};
+	// readers that entered at or before this epoch may hold the object
+	r->epoch = d.global.fetch_add(1, std::memory_order_acq_rel);
+	epoch_detail::push(r, r);
+	epoch_reclaim();
+}
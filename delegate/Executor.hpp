@@ -0,0 +1,638 @@
+#pragma once
+#include <libs/delegate/Delegate.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+//---------------------------------------------------------------------------------
+/// executor class
+/// work-stealing thread pool running delegate<void()> tasks.
+/// every worker owns a Chase-Lev deque: it pushes and takes tasks at the bottom
+/// without contention, while idle workers steal from the top. tasks posted from
+/// outside the pool go through a bounded lock-free injection queue; when it is
+/// full post() runs the task on the posting thread, while post_queued() puts it
+/// on a locked overflow list.
+/// a worker waiting on a task_future runs other tasks meanwhile, so tasks may
+/// fork and join recursively without blocking the pool.
+///
+///		executor pool;
+///		auto sum = pool.async([&] { return left.sum(); });
+///		auto total = right.sum() + sum.get();
+//---------------------------------------------------------------------------------
+class executor;
+template <typename R> class strand_future;
+
+namespace executor_detail {
+
+	using task = delegate<void()>;
+
+	/// Chase-Lev work-stealing deque of task pointers
+	/// (Lê, Pop, Cohen, Zappa Nardelli: Correct and efficient work-stealing for weak memory models)
+	class deque
+	{
+	public:
+		deque() :_array(new array(64)) {}
+
+		~deque()
+		{
+			delete _array.load(std::memory_order_relaxed);
+			for (auto a : _retired) {
+				delete a;
+			}
+		}
+
+		deque(const deque &) = delete;
+		deque & operator=(const deque &) = delete;
+
+		/// owner only
+		void push(task * t)
+		{
+			auto const b = _bottom.load(std::memory_order_relaxed);
+			auto const top = _top.load(std::memory_order_acquire);
+			auto a = _array.load(std::memory_order_relaxed);
+			if (b - top > std::int64_t(a->capacity) - 1) {
+				a = grow(a, top, b);
+			}
+			a->put(b, t);
+			_bottom.store(b + 1, std::memory_order_release);
+		}
+
+		/// owner only, nullptr when empty
+		task * take()
+		{
+			auto const b = _bottom.load(std::memory_order_relaxed) - 1;
+			auto a = _array.load(std::memory_order_relaxed);
+			_bottom.store(b, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			auto top = _top.load(std::memory_order_relaxed);
+			if (top > b) {
+				_bottom.store(b + 1, std::memory_order_relaxed);
+				return nullptr;
+			}
+			auto t = a->get(b);
+			if (top == b) {
+				// last task: race the thieves for it
+				if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+					t = nullptr;
+				}
+				_bottom.store(b + 1, std::memory_order_relaxed);
+			}
+			return t;
+		}
+
+		/// any thread, nullptr when empty or when another thread won the race
+		task * steal()
+		{
+			auto top = _top.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			auto const b = _bottom.load(std::memory_order_acquire);
+			if (top >= b) {
+				return nullptr;
+			}
+			auto t = _array.load(std::memory_order_acquire)->get(top);
+			if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+				return nullptr;
+			}
+			return t;
+		}
+
+		bool empty() const
+		{
+			return _top.load(std::memory_order_relaxed) >= _bottom.load(std::memory_order_relaxed);
+		}
+
+	private:
+		struct array
+		{
+			explicit array(std::size_t capacity) :capacity(capacity), slots(new std::atomic<task *>[capacity]) {}
+
+			task * get(std::int64_t i) const { return slots[std::size_t(i) & (capacity - 1)].load(std::memory_order_relaxed); }
+			void put(std::int64_t i, task * t) { slots[std::size_t(i) & (capacity - 1)].store(t, std::memory_order_relaxed); }
+
+			const std::size_t capacity;
+			std::unique_ptr<std::atomic<task *>[]> slots;
+		};
+
+		array * grow(array * a, std::int64_t top, std::int64_t bottom)
+		{
+			auto bigger = new array(a->capacity * 2);
+			for (auto i = top; i < bottom; i++) {
+				bigger->put(i, a->get(i));
+			}
+			// thieves may still read the old array: keep it until the deque dies
+			_retired.push_back(a);
+			_array.store(bigger, std::memory_order_release);
+			return bigger;
+		}
+
+		// thieves and owner update different cache lines
+		std::atomic<std::int64_t> _top{0};
+		char _padding[64];
+		std::atomic<std::int64_t> _bottom{0};
+		std::atomic<array *> _array;
+		std::vector<array *> _retired;
+	};
+
+	/// bounded multi-producer multi-consumer queue of pointers (Vyukov)
+	template <typename T>
+	class bounded_queue
+	{
+	public:
+		explicit bounded_queue(std::size_t capacity)
+		:_mask(capacity - 1)
+		,_cells(new cell[capacity])
+		{
+			for (std::size_t i = 0; i < capacity; i++) {
+				_cells[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		/// false when full
+		bool push(T * t)
+		{
+			auto position = _enqueue.load(std::memory_order_relaxed);
+			cell * c;
+			for (;;) {
+				c = &_cells[position & _mask];
+				auto const sequence = c->sequence.load(std::memory_order_acquire);
+				auto const difference = std::intptr_t(sequence) - std::intptr_t(position);
+				if (difference == 0) {
+					if (_enqueue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+						break;
+					}
+				} else if (difference < 0) {
+					return false;
+				} else {
+					position = _enqueue.load(std::memory_order_relaxed);
+				}
+			}
+			c->value = t;
+			c->sequence.store(position + 1, std::memory_order_release);
+			return true;
+		}
+
+		/// nullptr when empty
+		T * pop()
+		{
+			auto position = _dequeue.load(std::memory_order_relaxed);
+			cell * c;
+			for (;;) {
+				c = &_cells[position & _mask];
+				auto const sequence = c->sequence.load(std::memory_order_acquire);
+				auto const difference = std::intptr_t(sequence) - std::intptr_t(position + 1);
+				if (difference == 0) {
+					if (_dequeue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+						break;
+					}
+				} else if (difference < 0) {
+					return nullptr;
+				} else {
+					position = _dequeue.load(std::memory_order_relaxed);
+				}
+			}
+			auto t = c->value;
+			c->sequence.store(position + _mask + 1, std::memory_order_release);
+			return t;
+		}
+
+		bool empty() const
+		{
+			return _enqueue.load(std::memory_order_relaxed) == _dequeue.load(std::memory_order_relaxed);
+		}
+
+	private:
+		struct cell
+		{
+			std::atomic<std::size_t> sequence;
+			T * value;
+		};
+
+		const std::size_t _mask;
+		std::unique_ptr<cell[]> _cells;
+		// producers and consumers update different cache lines
+		std::atomic<std::size_t> _enqueue{0};
+		char _padding[64];
+		std::atomic<std::size_t> _dequeue{0};
+	};
+
+	using injection_queue = bounded_queue<task>;
+
+	/// completion shared by a task and its future
+	class state_base
+	{
+	public:
+		bool ready() const { return _ready.load(std::memory_order_acquire); }
+
+		/// blocks a thread that cannot help
+		void wait()
+		{
+			if (ready()) {
+				return;
+			}
+			_waiting.store(true, std::memory_order_seq_cst);
+			std::unique_lock<std::mutex> lock(_mutex);
+			_completed.wait(lock, [this] { return ready(); });
+		}
+
+	protected:
+		/// makes a completed state reusable
+		void reset()
+		{
+			_ready.store(false, std::memory_order_relaxed);
+			_waiting.store(false, std::memory_order_relaxed);
+			_error = nullptr;
+		}
+
+		void complete()
+		{
+			_ready.store(true, std::memory_order_seq_cst);
+			if (_waiting.load(std::memory_order_seq_cst)) {
+				std::lock_guard<std::mutex> lock(_mutex);
+				_completed.notify_all();
+			}
+		}
+
+		void rethrow()
+		{
+			if (_error) {
+				std::rethrow_exception(_error);
+			}
+		}
+
+		std::exception_ptr _error;
+
+	private:
+		std::atomic<bool> _ready{false};
+		std::atomic<bool> _waiting{false};
+		std::mutex _mutex;
+		std::condition_variable _completed;
+	};
+
+	template <typename R>
+	class state : public state_base
+	{
+	public:
+		~state()
+		{
+			if (_has_value) {
+				reinterpret_cast<R *>(&_value)->~R();
+			}
+		}
+
+		template <typename F>
+		void run(F & f)
+		{
+			try {
+				new (&_value) R(f());
+				_has_value = true;
+			} catch (...) {
+				_error = std::current_exception();
+			}
+			complete();
+		}
+
+		R get()
+		{
+			rethrow();
+			return std::move(*reinterpret_cast<R *>(&_value));
+		}
+
+	private:
+		typename std::aligned_storage<sizeof(R), alignof(R)>::type _value;
+		bool _has_value = false;
+	};
+
+	template <>
+	class state<void> : public state_base
+	{
+	public:
+		template <typename F>
+		void run(F & f)
+		{
+			try {
+				f();
+			} catch (...) {
+				_error = std::current_exception();
+			}
+			complete();
+		}
+
+		void get() { rethrow(); }
+	};
+
+	struct worker_identity
+	{
+		executor * pool;
+		std::size_t index;
+	};
+
+	inline worker_identity & this_worker()
+	{
+		static thread_local worker_identity identity{nullptr, 0};
+		return identity;
+	}
+}
+
+/// result of executor::async. get() may be called once.
+template <typename R>
+class task_future
+{
+public:
+	task_future() = default;
+
+	bool valid() const { return bool(_state); }
+
+	/// true once the task finished, without waiting
+	bool ready() const { return _state->ready(); }
+
+	/// waits for the task without taking its result
+	void wait();
+
+	/// waits for the task. a worker of the pool runs other tasks while it waits.
+	R get();
+
+private:
+	friend class executor;
+
+	task_future(std::shared_ptr<executor_detail::state<R>> state, executor * pool)
+	:_state(std::move(state))
+	,_pool(pool)
+	{}
+
+	std::shared_ptr<executor_detail::state<R>> _state;
+	executor * _pool = nullptr;
+};
+
+class executor
+{
+public:
+	using task = executor_detail::task;
+
+	explicit executor(std::size_t threads = std::thread::hardware_concurrency(), std::size_t injection_capacity = 4096)
+	:_injected(round_up(injection_capacity))
+	{
+		if (!threads) {
+			threads = 1;
+		}
+		for (std::size_t i = 0; i < threads; i++) {
+			_deques.emplace_back(new executor_detail::deque);
+		}
+		for (std::size_t i = 0; i < threads; i++) {
+			_workers.emplace_back([this, i] { work(i); });
+		}
+	}
+
+	executor(const executor &) = delete;
+	executor & operator=(const executor &) = delete;
+
+	/// runs every task posted so far, then stops the workers
+	~executor()
+	{
+		_stopping.store(true, std::memory_order_seq_cst);
+		{
+			std::lock_guard<std::mutex> lock(_sleep_mutex);
+			_wake.notify_all();
+		}
+		for (auto & w : _workers) {
+			w.join();
+		}
+	}
+
+	std::size_t size() const { return _workers.size(); }
+
+	/// queues t, on the calling worker's own deque when called from a task.
+	/// an exception thrown by t is dropped and counted in failed(); use async()
+	/// to get it.
+	void post(task t)
+	{
+		schedule(new task(std::move(t)));
+	}
+
+	/// queues t like post(), but never runs it on the calling thread: when the
+	/// injection queue is full t waits on the overflow list. for threads that
+	/// must not be held up by tasks, such as a timer thread.
+	void post_queued(task t)
+	{
+		schedule(new task(std::move(t)), true);
+	}
+
+	/// queues t without copying it. t must stay alive until it ran; the pool
+	/// does not own it, so a task that reposts itself does not allocate.
+	void post_unowned(task & t)
+	{
+		schedule(reinterpret_cast<task *>(reinterpret_cast<std::uintptr_t>(&t) | unowned));
+	}
+
+	/// runs f() on the pool
+	template <typename F>
+	task_future<std::result_of_t<F()>> async(F f)
+	{
+		using R = std::result_of_t<F()>;
+		auto state = std::make_shared<executor_detail::state<R>>();
+		post([state, f]() mutable { state->run(f); });
+		return task_future<R>(std::move(state), this);
+	}
+
+	/// tasks of post() and post_queued() that ended with an exception
+	std::size_t failed() const { return _failed.load(std::memory_order_relaxed); }
+
+	/// runs one queued task on the calling thread if there is one
+	bool run_one()
+	{
+		auto & self = executor_detail::this_worker();
+		auto const index = self.pool == this ? self.index : _deques.size();
+		if (auto t = find_task(index)) {
+			run(t);
+			return true;
+		}
+		return false;
+	}
+
+private:
+	template <typename R> friend class task_future;
+	template <typename R> friend class strand_future;
+
+	// low bit of a queued pointer: the task is not deleted after it ran
+	static const std::uintptr_t unowned = 1;
+
+	void schedule(task * node, bool queued = false)
+	{
+		auto & self = executor_detail::this_worker();
+		if (self.pool == this) {
+			_deques[self.index]->push(node);
+		} else if (!_injected.push(node)) {
+			if (!queued) {
+				run(node);
+				return;
+			}
+			std::lock_guard<std::mutex> lock(_overflow_mutex);
+			_overflow.push_back(node);
+			_overflowed.store(_overflow.size(), std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (_sleepers.load(std::memory_order_relaxed)) {
+			std::lock_guard<std::mutex> lock(_sleep_mutex);
+			_wake.notify_one();
+		}
+	}
+
+	static std::size_t round_up(std::size_t n)
+	{
+		std::size_t capacity = 2;
+		while (capacity < n) {
+			capacity *= 2;
+		}
+		return capacity;
+	}
+
+	void run(task * t)
+	{
+		auto const bits = reinterpret_cast<std::uintptr_t>(t);
+		std::unique_ptr<task> owned(bits & unowned ? nullptr : t);
+		try {
+			(*reinterpret_cast<task *>(bits & ~unowned))();
+		} catch (...) {
+			// a worker must outlive its tasks
+			_failed.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	// own deque first, then the injection queue, then the other workers
+	task * find_task(std::size_t index)
+	{
+		if (index < _deques.size()) {
+			if (auto t = _deques[index]->take()) {
+				return t;
+			}
+		}
+		if (auto t = _injected.pop()) {
+			return t;
+		}
+		if (_overflowed.load(std::memory_order_relaxed)) {
+			std::lock_guard<std::mutex> lock(_overflow_mutex);
+			if (!_overflow.empty()) {
+				auto t = _overflow.front();
+				_overflow.pop_front();
+				_overflowed.store(_overflow.size(), std::memory_order_relaxed);
+				return t;
+			}
+		}
+		auto const n = _deques.size();
+		auto const start = next_victim() % n;
+		for (std::size_t i = 0; i < n; i++) {
+			auto const victim = (start + i) % n;
+			if (victim != index) {
+				if (auto t = _deques[victim]->steal()) {
+					return t;
+				}
+			}
+		}
+		return nullptr;
+	}
+
+	static std::size_t next_victim()
+	{
+		static thread_local std::uint32_t seed = 0;
+		if (!seed) {
+			seed = std::uint32_t(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+		}
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		return seed;
+	}
+
+	bool has_work() const
+	{
+		if (!_injected.empty() || _overflowed.load(std::memory_order_relaxed)) {
+			return true;
+		}
+		for (auto & d : _deques) {
+			if (!d->empty()) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void work(std::size_t index)
+	{
+		executor_detail::this_worker() = {this, index};
+		unsigned idle = 0;
+		for (;;) {
+			if (auto t = find_task(index)) {
+				run(t);
+				idle = 0;
+				continue;
+			}
+			if (_stopping.load(std::memory_order_acquire) && !has_work()) {
+				return;
+			}
+			if (++idle < 64) {
+				std::this_thread::yield();
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(_sleep_mutex);
+			_sleepers.fetch_add(1, std::memory_order_seq_cst);
+			if (!_stopping.load(std::memory_order_seq_cst) && !has_work()) {
+				// the timeout only guards against a missed wake up
+				_wake.wait_for(lock, std::chrono::milliseconds(10));
+			}
+			_sleepers.fetch_sub(1, std::memory_order_relaxed);
+			idle = 0;
+		}
+	}
+
+	void wait(executor_detail::state_base & state)
+	{
+		if (executor_detail::this_worker().pool != this) {
+			// help while there is work, then block
+			while (!state.ready() && run_one()) {}
+			state.wait();
+			return;
+		}
+		while (!state.ready()) {
+			if (!run_one()) {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	std::vector<std::unique_ptr<executor_detail::deque>> _deques;
+	executor_detail::injection_queue _injected;
+	// tasks of post_queued() that did not fit in the injection queue
+	std::mutex _overflow_mutex;
+	std::deque<task *> _overflow;
+	std::atomic<std::size_t> _overflowed{0};
+	std::atomic<bool> _stopping{false};
+	std::atomic<std::size_t> _failed{0};
+	std::atomic<unsigned> _sleepers{0};
+	std::mutex _sleep_mutex;
+	std::condition_variable _wake;
+	std::vector<std::thread> _workers;
+};
+
+template <typename R>
+void task_future<R>::wait()
+{
+	if (!_state->ready()) {
+		_pool->wait(*_state);
+	}
+}
+
+template <typename R>
+R task_future<R>::get()
+{
+	wait();
+	auto state = std::move(_state);
+	return state->get();
+}
@@ -1,6 +1,18 @@
+#pragma once
 #include <stdio.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
 #include <string>
+#include <sstream>
+#include <tuple>
+#include <utility>
+#include <vector>
 #include <iostream>
+#include <libs/delegate/JsonScan.hpp>
+#include <libs/delegate/MsgPack.hpp>
 #include <jsonrpccpp/server.h>
 #include <jsonrpccpp/server/connectors/httpserver.h>
 #include <jsonrpccpp/server/connectors/unixdomainsocketserver.h>
@@ -32,7 +44,6 @@ template<> std::string type<float>() { return "float"; };
 template<> std::string type<double>() { return "double"; };
 template<> std::string type<std::string>() { return "string"; };
 
-// ------- compare Json::Value array to tuple of fundamental types
 template<std::size_t> struct int_{};
 
 // tuple_element_t appears in C++14.  defined here for use in C++11
@@ -41,6 +52,26 @@ namespace std {
     using tuple_element_t = typename tuple_element<I, T>::type;
 }
 
+//------print tuple ---
+template <class Tuple, size_t Pos>
+std::ostream& print_tuple_out(std::ostream& out, const Tuple& t, int_<Pos> ) {
+  out << std::get< std::tuple_size<Tuple>::value-Pos >(t) << ',';
+  return print_tuple_out(out, t, int_<Pos-1>());
+}
+
+template <class Tuple>
+std::ostream& print_tuple_out(std::ostream& out, const Tuple& t, int_<1> ) {
+  return out << std::get<std::tuple_size<Tuple>::value-1>(t);
+}
+
+template <class... Args>
+std::ostream& operator<<(std::ostream& out, const std::tuple<Args...>& t) {
+  out << '(';
+  print_tuple_out(out, t, int_<sizeof...(Args)>());
+  return out << ')';
+}
+
+// ------- compare Json::Value array to tuple of fundamental types
 template <typename Tuple, size_t Pos>
 bool is_json_tuple2(const Json::Value& mV, Tuple & mX, int_<Pos>)
 {
@@ -137,27 +168,6 @@ bool tuple_to_json(const std::tuple<Args...>& t,Json::Value & out) {
 }
 
 
-//------print tuple ---
-template <class Tuple, size_t Pos>
-std::ostream& print_tuple_out(std::ostream& out, const Tuple& t, int_<Pos> ) {
-  out << std::get< std::tuple_size<Tuple>::value-Pos >(t) << ',';
-  return print_tuple_out(out, t, int_<Pos-1>());
-}
-
-template <class Tuple>
-std::ostream& print_tuple_out(std::ostream& out, const Tuple& t, int_<1> ) {
-  return out << std::get<std::tuple_size<Tuple>::value-1>(t);
-}
-
-template <class... Args>
-std::ostream& operator<<(std::ostream& out, const std::tuple<Args...>& t) {
-  out << '(';
-  print_tuple_out(out, t, int_<sizeof...(Args)>());
-  return out << ')';
-}
-
-
-
 // ------- apply function to tuple -------
 /*
 // TODO Use this apply method after upgrading to C++14
@@ -208,37 +218,570 @@ inline auto apply(const F& f, const std::tuple<Args...>& params) -> decltype( f(
 
 
 
+// ------- convert Json::Value array to tuple of fundamental types in one pass
+// every element is checked and converted in place, without copying it
+namespace json_detail {
+
+	template <std::size_t I, typename Tuple>
+	bool decode_element(const Json::Value & mV, Tuple & mX)
+	{
+		using T = std::tuple_element_t<I,Tuple>;
+		const Json::Value & val = mV[Json::ArrayIndex(I)];
+		if(!is<T>(val)) {
+			std::cout << ("Invalid Argument " + std::to_string(I) + " Json: " + val.toStyledString() + " Expected: " + type<T>());
+			return false;
+		}
+		std::get<I>(mX) = as<T>(val);
+		return true;
+	}
+
+	template <typename Tuple, std::size_t... I>
+	bool decode_tuple(const Json::Value & mV, Tuple & mX, std::index_sequence<I...>)
+	{
+		if(!mV.isArray() && !mV.isNull()) {
+			return false;
+		}
+		bool ok = true;
+		// braced initialization decodes in order, && stops at the first mismatch
+		int expand[] = { 0, (ok = ok && decode_element<I>(mV, mX), 0)... };
+		(void)expand;
+		return ok;
+	}
+
+	// calls f with the elements of t moved out
+	template <typename F, typename Tuple, std::size_t... I>
+	auto apply_moved(const F & f, Tuple && t, std::index_sequence<I...>) -> decltype(f(std::get<I>(std::move(t))...))
+	{
+		return f(std::get<I>(std::move(t))...);
+	}
+}
+
+template <typename... Args>
+bool decode_json_tuple(const Json::Value & mV, std::tuple<Args...> & mX)
+{
+	return json_detail::decode_tuple(mV, mX, std::index_sequence_for<Args...>());
+}
+
+
 // ------- convert function to function that takes Json::Value and returns Json::Value ----
+// the argument types are resolved here, once per function
 
 template <typename F>
 auto make_json_function(F && f)
 {
+	using arguments_type = decltype(decltype(make_delegate(f))::tuple());
+	using indices = std::make_index_sequence<std::tuple_size<arguments_type>::value>;
 	return [f](const Json::Value & json_in) {
-		auto args_tuple = make_delegate(f).tuple();
-		if(!json_to_tuple(json_in,args_tuple)) {
+		arguments_type args_tuple;
+		if(!json_detail::decode_tuple(json_in,args_tuple,indices())) {
 			std::stringstream ss; ss << "[apply_json] invalid arguments: json = " << json_in << " tuple = " << args_tuple;
 			//throw std::invalid_argument( ss.str());
 			std::cout << ss.str();
 			return Json::Value();
 		}
-		auto ret = apply(f,args_tuple);
-		return Json::Value(ret);
+		return Json::Value(json_detail::apply_moved(f,std::move(args_tuple),indices()));
+	};
+}
+
+// ------- read a Json array text straight into a tuple of fundamental types ----
+// no Json::Value is built: every element is parsed into its tuple element.
+// the reader only takes the plain forms of the values; anything else makes it fail,
+// and the caller falls back to parse_json, which also reports the errors
+namespace json_detail {
+
+	template <typename T> struct streamable : std::false_type {};
+	template <> struct streamable<bool> : std::true_type {};
+	template <> struct streamable<int> : std::true_type {};
+	template <> struct streamable<float> : std::true_type {};
+	template <> struct streamable<double> : std::true_type {};
+	template <> struct streamable<std::string> : std::true_type {};
+
+	template <typename Tuple> struct tuple_streamable;
+	template <> struct tuple_streamable<std::tuple<>> : std::true_type {};
+	template <typename T, typename... Rest>
+	struct tuple_streamable<std::tuple<T, Rest...>>
+	: std::integral_constant<bool, streamable<T>::value && tuple_streamable<std::tuple<Rest...>>::value> {};
+
+	class array_reader
+	{
+	public:
+		explicit array_reader(const std::string & text) :_p(text.c_str()), _end(text.c_str() + text.size()) {}
+
+		bool begin() { skip(); return take('['); }
+		// before every element but the first
+		bool separator() { skip(); return take(','); }
+		bool end()
+		{
+			skip();
+			if(!take(']')) {
+				return false;
+			}
+			skip();
+			return _p == _end;
+		}
+
+		bool read(bool & v)
+		{
+			skip();
+			if(literal("true")) { v = true; return true; }
+			if(literal("false")) { v = false; return true; }
+			return false;
+		}
+
+		// integers in the range of int, without fraction or exponent
+		bool read(int & v)
+		{
+			skip();
+			bool negative = take('-');
+			if(_p == _end || *_p < '0' || *_p > '9' || (*_p == '0' && _p + 1 < _end && is_digit(_p[1]))) {
+				return false;
+			}
+			long long value = 0;
+			while(_p < _end && is_digit(*_p)) {
+				value = value * 10 + (*_p++ - '0');
+				if(value > 2147483648LL) {
+					return false;
+				}
+			}
+			if(_p < _end && (*_p == '.' || *_p == 'e' || *_p == 'E')) {
+				return false;
+			}
+			value = negative ? -value : value;
+			if(value > 2147483647LL) {
+				return false;
+			}
+			v = int(value);
+			return true;
+		}
+
+		bool read(double & v)
+		{
+			skip();
+			auto const start = _p;
+			take('-');
+			if(!digits()) {
+				return false;
+			}
+			if(take('.') && !digits()) {
+				return false;
+			}
+			if(take('e') || take('E')) {
+				if(!take('+')) {
+					take('-');
+				}
+				if(!digits()) {
+					return false;
+				}
+			}
+			// the text is null terminated and the number is followed by a delimiter
+			char * parsed;
+			v = std::strtod(start, &parsed);
+			return parsed == _p;
+		}
+
+		bool read(float & v)
+		{
+			double d;
+			if(!read(d)) {
+				return false;
+			}
+			v = float(d);
+			return true;
+		}
+
+		bool read(std::string & v)
+		{
+			skip();
+			if(!take('"')) {
+				return false;
+			}
+			v.clear();
+			for(;;) {
+				auto const run = _p;
+				while(_p < _end && *_p != '"' && *_p != '\\' && static_cast<unsigned char>(*_p) >= 0x20) {
+					_p++;
+				}
+				v.append(run, _p);
+				if(_p == _end || static_cast<unsigned char>(*_p) < 0x20) {
+					return false;
+				}
+				if(*_p++ == '"') {
+					return true;
+				}
+				if(_p == _end) {
+					return false;
+				}
+				switch(*_p++) {
+				case '"': v += '"'; break;
+				case '\\': v += '\\'; break;
+				case '/': v += '/'; break;
+				case 'b': v += '\b'; break;
+				case 'f': v += '\f'; break;
+				case 'n': v += '\n'; break;
+				case 'r': v += '\r'; break;
+				case 't': v += '\t'; break;
+				case 'u': if(!unicode(v)) { return false; } break;
+				default: return false;
+				}
+			}
+		}
+
+	private:
+		static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+		void skip()
+		{
+			while(_p < _end && (*_p == ' ' || *_p == '\t' || *_p == '\n' || *_p == '\r')) {
+				_p++;
+			}
+		}
+
+		bool take(char c)
+		{
+			if(_p < _end && *_p == c) {
+				_p++;
+				return true;
+			}
+			return false;
+		}
+
+		bool literal(const char * word)
+		{
+			auto p = _p;
+			for(; *word; word++, p++) {
+				if(p == _end || *p != *word) {
+					return false;
+				}
+			}
+			_p = p;
+			return true;
+		}
+
+		bool digits()
+		{
+			auto const start = _p;
+			while(_p < _end && is_digit(*_p)) {
+				_p++;
+			}
+			return _p != start;
+		}
+
+		bool hex4(unsigned & code)
+		{
+			if(_end - _p < 4) {
+				return false;
+			}
+			code = 0;
+			for(int i = 0; i < 4; i++) {
+				char c = *_p++;
+				code <<= 4;
+				if(c >= '0' && c <= '9') code |= unsigned(c - '0');
+				else if(c >= 'a' && c <= 'f') code |= unsigned(c - 'a' + 10);
+				else if(c >= 'A' && c <= 'F') code |= unsigned(c - 'A' + 10);
+				else return false;
+			}
+			return true;
+		}
+
+		// \uXXXX, with surrogate pairs, appended as utf-8
+		bool unicode(std::string & v)
+		{
+			unsigned code;
+			if(!hex4(code)) {
+				return false;
+			}
+			if(code >= 0xD800 && code <= 0xDBFF) {
+				unsigned low;
+				if(!take('\\') || !take('u') || !hex4(low) || low < 0xDC00 || low > 0xDFFF) {
+					return false;
+				}
+				code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+			} else if(code >= 0xDC00 && code <= 0xDFFF) {
+				return false;
+			}
+			if(code < 0x80) {
+				v += char(code);
+			} else if(code < 0x800) {
+				v += char(0xC0 | (code >> 6));
+				v += char(0x80 | (code & 0x3F));
+			} else if(code < 0x10000) {
+				v += char(0xE0 | (code >> 12));
+				v += char(0x80 | ((code >> 6) & 0x3F));
+				v += char(0x80 | (code & 0x3F));
+			} else {
+				v += char(0xF0 | (code >> 18));
+				v += char(0x80 | ((code >> 12) & 0x3F));
+				v += char(0x80 | ((code >> 6) & 0x3F));
+				v += char(0x80 | (code & 0x3F));
+			}
+			return true;
+		}
+
+		const char * _p;
+		const char * const _end;
+	};
+
+	template <typename Tuple, std::size_t... I>
+	bool read_tuple(array_reader & reader, Tuple & mX, std::index_sequence<I...>)
+	{
+		if(!reader.begin()) {
+			return false;
+		}
+		bool ok = true;
+		int expand[] = { 0, (ok = ok && (I == 0 || reader.separator()) && reader.read(std::get<I>(mX)), 0)... };
+		(void)expand;
+		return ok && reader.end();
+	}
+}
+
+template <typename... Args>
+bool read_json_tuple(const std::string & text, std::tuple<Args...> & mX)
+{
+	json_detail::array_reader reader(text);
+	return json_detail::read_tuple(reader, mX, std::index_sequence_for<Args...>());
+}
+
+// ------- convert MessagePack element to fundamental type---
+// the same checks as for Json::Value: a number is a double, an integral one is also an int
+template <class T> T as(const msgpack_codec::object & v);
+
+template<> inline bool as<bool>(const msgpack_codec::object & v) { return v.boolean; };
+template<> inline int as<int>(const msgpack_codec::object & v) { return v.type == msgpack_codec::kind::floating ? int(v.floating) : int(v.integer); };
+template<> inline double as<double>(const msgpack_codec::object & v) {
+	switch(v.type) {
+	case msgpack_codec::kind::floating: return v.floating;
+	case msgpack_codec::kind::unsigned_integer: return double(v.unsigned_integer);
+	default: return double(v.integer);
+	}
+};
+template<> inline float as<float>(const msgpack_codec::object & v) { return float(as<double>(v)); };
+template<> inline std::string as<std::string>(const msgpack_codec::object & v) { return std::string(v.data, v.size); };
+
+template <class T> bool is(const msgpack_codec::object & v);
+
+template<> inline bool is<bool>(const msgpack_codec::object & v) { return v.type == msgpack_codec::kind::boolean; };
+template<> inline bool is<int>(const msgpack_codec::object & v) {
+	if(v.type == msgpack_codec::kind::floating) {
+		return v.floating >= -2147483648.0 && v.floating <= 2147483647.0 && double(int(v.floating)) == v.floating;
+	}
+	return v.type == msgpack_codec::kind::integer && v.integer >= -2147483648LL && v.integer <= 2147483647LL;
+};
+template<> inline bool is<double>(const msgpack_codec::object & v) {
+	return v.type == msgpack_codec::kind::floating || v.type == msgpack_codec::kind::integer || v.type == msgpack_codec::kind::unsigned_integer;
+};
+template<> inline bool is<float>(const msgpack_codec::object & v) { return is<double>(v); };
+template<> inline bool is<std::string>(const msgpack_codec::object & v) { return v.type == msgpack_codec::kind::string; };
+
+// ------- read a MessagePack array straight into a tuple of fundamental types ----
+// elements past the arguments are read over, as they are in a Json array
+namespace json_detail {
+
+	template <std::size_t I, typename Tuple>
+	bool unpack_element(msgpack_codec::reader & reader, Tuple & mX)
+	{
+		using T = std::tuple_element_t<I,Tuple>;
+		msgpack_codec::object val;
+		if(!reader.next(val) || !is<T>(val)) {
+			return false;
+		}
+		std::get<I>(mX) = as<T>(val);
+		return true;
+	}
+
+	template <typename Tuple, std::size_t... I>
+	bool unpack_tuple(msgpack_codec::reader & reader, Tuple & mX, std::index_sequence<I...>)
+	{
+		msgpack_codec::object array;
+		if(!reader.next(array) || array.type != msgpack_codec::kind::array || array.size < sizeof...(I)) {
+			return false;
+		}
+		bool ok = true;
+		int expand[] = { 0, (ok = ok && unpack_element<I>(reader, mX), 0)... };
+		(void)expand;
+		for(std::uint32_t extra = sizeof...(I); ok && extra < array.size; extra++) {
+			ok = reader.skip();
+		}
+		return ok && reader.at_end();
+	}
+}
+
+template <typename... Args>
+bool unpack_msgpack_tuple(const std::string & bytes, std::tuple<Args...> & mX)
+{
+	msgpack_codec::reader reader(bytes);
+	return json_detail::unpack_tuple(reader, mX, std::index_sequence_for<Args...>());
+}
+
+// ------- convert function to function that takes and returns MessagePack ----
+// returns false, without calling f, when the arguments are not read; the caller then decodes them into Json
+
+template <typename F>
+auto make_binary_function(F && f)
+{
+	using arguments_type = decltype(decltype(make_delegate(f))::tuple());
+	using indices = std::make_index_sequence<std::tuple_size<arguments_type>::value>;
+	return [f](const std::string & bytes_in, std::string & bytes_out) {
+		arguments_type args_tuple;
+		msgpack_codec::reader reader(bytes_in);
+		if(!json_detail::unpack_tuple(reader,args_tuple,indices())) {
+			return false;
+		}
+		bytes_out.clear();
+		msgpack_codec::writer(bytes_out).write(json_detail::apply_moved(f,std::move(args_tuple),indices()));
+		return true;
+	};
+}
+
+// ------- convert function to function that takes the Json text of its arguments ----
+// returns false, without calling f, when the text is not read; parse_json then has to parse it
+
+template <typename F>
+auto make_json_string_function(F && f)
+{
+	using arguments_type = decltype(decltype(make_delegate(f))::tuple());
+	using indices = std::make_index_sequence<std::tuple_size<arguments_type>::value>;
+	return [f](const std::string & json_in, Json::Value & json_out) {
+		arguments_type args_tuple;
+		json_detail::array_reader reader(json_in);
+		if(!json_detail::read_tuple(reader,args_tuple,indices())) {
+			return false;
+		}
+		json_out = Json::Value(json_detail::apply_moved(f,std::move(args_tuple),indices()));
+		return true;
+	};
+}
+
+// ------- dense ids of names, found through an open addressing table ----
+// ids count up from 0 in the order the names are inserted. the table is kept at most
+// half full; a slot holds the upper half of the hash of its name, so a probe compares
+// a string only when the hashes match.
+namespace json_detail {
+
+	class name_index
+	{
+	public:
+		static const std::uint32_t none = ~std::uint32_t(0);
+
+		std::uint32_t find(const char * name, std::size_t size) const
+		{
+			if(_slots.empty()) {
+				return none;
+			}
+			auto const h = hash(name, size);
+			auto const mask = _slots.size() - 1;
+			for(auto i = std::size_t(h) & mask; ; i = (i + 1) & mask) {
+				auto const & s = _slots[i];
+				if(s.id == none) {
+					return none;
+				}
+				if(s.tag == std::uint32_t(h >> 32) && _names[s.id].size() == size && !std::memcmp(_names[s.id].data(), name, size)) {
+					return s.id;
+				}
+			}
+		}
+
+		// the id of name, a new one when name is not known
+		std::uint32_t insert(const std::string & name)
+		{
+			auto id = find(name.data(), name.size());
+			if(id != none) {
+				return id;
+			}
+			id = std::uint32_t(_names.size());
+			_names.push_back(name);
+			if(2 * _names.size() > _slots.size()) {
+				rehash(std::max<std::size_t>(16, 2 * _slots.size()));
+			} else {
+				place(id);
+			}
+			return id;
+		}
+
+		std::size_t size() const { return _names.size(); }
+		const std::string & name(std::uint32_t id) const { return _names[id]; }
+
+	private:
+		struct slot
+		{
+			std::uint32_t tag;
+			std::uint32_t id;
+		};
+
+		// FNV-1a
+		static std::uint64_t hash(const char * p, std::size_t size)
+		{
+			std::uint64_t h = 14695981039346656037ULL;
+			for(std::size_t i = 0; i < size; i++) {
+				h = (h ^ static_cast<unsigned char>(p[i])) * 1099511628211ULL;
+			}
+			return h;
+		}
+
+		void place(std::uint32_t id)
+		{
+			auto const h = hash(_names[id].data(), _names[id].size());
+			auto const mask = _slots.size() - 1;
+			auto i = std::size_t(h) & mask;
+			while(_slots[i].id != none) {
+				i = (i + 1) & mask;
+			}
+			_slots[i] = slot{std::uint32_t(h >> 32), id};
+		}
+
+		void rehash(std::size_t capacity)
+		{
+			_slots.assign(capacity, slot{0, none});
+			for(std::uint32_t id = 0; id < _names.size(); id++) {
+				place(id);
+			}
+		}
+
+		std::vector<std::string> _names;
+		std::vector<slot> _slots;
 	};
 }
 
 // ------- maintains a mapping from function name to json_function ----
+// every function gets a dense handle; resolve() finds it once, and calls through
+// the handle index the functions without looking the name up again
 
 struct JsonFunctions
 {
 	using json_function = delegate<Json::Value(const Json::Value&)>;
-	std::map<std::string,json_function> _functions;
+	using string_function = delegate<bool(const std::string&, Json::Value&)>;
+	using binary_function = delegate<bool(const std::string&, std::string&)>;
+
+	// id of a function, false for a name that is not known
+	struct handle
+	{
+		std::uint32_t id;
+		explicit operator bool() const { return id != json_detail::name_index::none; }
+	};
+
+	struct entry
+	{
+		json_function json;
+		// empty unless all the arguments are read from text without Json::Value
+		string_function text;
+		// the same, called with MessagePack
+		binary_function binary;
+	};
+
+	json_detail::name_index _names;
+	// by handle
+	std::vector<entry> _functions;
 	std::map<std::string,std::string> _parameters;
 
+	// encodings of arguments and results, named by content type
+	enum wire_format { json, msgpack, unsupported };
+
 	template<typename F>
 	void add_function(std::string name, F && f ) {
-		_functions[name] = make_json_function(f);
+		auto & e = add(name);
+		e.json = make_json_function(f);
+		add_string_function(e, f, json_detail::tuple_streamable<decltype(decltype(make_delegate(f))::tuple())>());
 		Json::Value tuple_json;
-		auto parameters_tuple = make_delegate(f).tuple();
+		auto parameters_tuple = decltype(make_delegate(f))::tuple();
 		tuple_to_json(parameters_tuple,tuple_json);
 		_parameters[name] = tuple_json.toStyledString();
 	}
@@ -248,31 +791,169 @@ struct JsonFunctions
 		add_function(name,make_delegate(obj,f));
 	}
 
-	bool contains(std::string name) const {
-		return _functions.find(name) != _functions.end();
+	// adds a function that takes and returns Json directly
+	void add_json_function(std::string name, json_function f, std::string parameters = "[]") {
+		add(name) = entry{f, string_function(), binary_function()};
+		_parameters[name] = parameters;
+	}
+
+	template<typename F>
+	void add_string_function(entry & e, F & f, std::true_type) {
+		e.text = make_json_string_function(f);
+		e.binary = make_binary_function(f);
+	}
+
+	template<typename F>
+	void add_string_function(entry & e, F &, std::false_type) {
+		e.text.reset();
+		e.binary.reset();
+	}
+
+	handle resolve(const char * name, std::size_t size) const {
+		return handle{_names.find(name, size)};
+	}
+
+	handle resolve(const std::string & name) const {
+		return resolve(name.data(), name.size());
+	}
+
+	bool contains(const std::string & name) const {
+		return bool(resolve(name));
 	}
 
-	Json::Value call_from_string(std::string name, std::string args) const {
+	Json::Value call_from_string(handle h, const std::string & args) const {
+		auto & e = at(h);
+		if(e.text) {
+			Json::Value out;
+			if(e.text(args, out)) {
+				return out;
+			}
+		}
 		Json::Value val;
-		Json::Reader reader;
-		if(!reader.parse(args,val)) {
+		if(!parse_json(args,val)) {
 			throw std::invalid_argument("Could not parse arguments as Json array: " + args);
 		}
-		return call(name,val);
+		return e.json(val);
+	}
+
+	Json::Value call_from_string(const std::string & name, const std::string & args) const {
+		return call_from_string(at(name), args);
 	}
 
-	Json::Value call(std::string name, const Json::Value & args) const {
+	// calls a function with a MessagePack array of arguments, returns the MessagePack result
+	std::string call_binary(handle h, const std::string & args) const {
+		auto & e = at(h);
+		if(e.binary) {
+			std::string out;
+			if(e.binary(args, out)) {
+				return out;
+			}
+		}
+		Json::Value val;
+		if(!msgpack_codec::decode(args,val)) {
+			throw std::invalid_argument("Could not decode arguments as MessagePack array");
+		}
+		std::string out;
+		msgpack_codec::encode(e.json(val), out);
+		return out;
+	}
+
+	std::string call_binary(const std::string & name, const std::string & args) const {
+		return call_binary(at(name), args);
+	}
+
+	// the format of a content type like "application/json; charset=utf-8"
+	static wire_format format_of(const std::string & content_type) {
+		auto media = content_type.substr(0, content_type.find(';'));
+		media.erase(media.find_last_not_of(" \t") + 1);
+		for(auto & c : media) {
+			c = char(std::tolower(static_cast<unsigned char>(c)));
+		}
+		if(media.empty() || media == "application/json") {
+			return json;
+		}
+		if(media == "application/msgpack" || media == "application/x-msgpack" || media == "application/vnd.msgpack") {
+			return msgpack;
+		}
+		return unsupported;
+	}
+
+	// calls name with a body of the given content type, returns the result in the same format
+	std::string call_encoded(const std::string & name, const std::string & content_type, const std::string & body) const {
+		switch(format_of(content_type)) {
+		case json: return Json::FastWriter().write(call_from_string(name, body));
+		case msgpack: return call_binary(name, body);
+		default: throw std::invalid_argument("Unsupported content type: " + content_type);
+		}
+	}
+
+	Json::Value call(handle h, const Json::Value & args) const {
+		return at(h).json(args);
+	}
+
+	Json::Value call(const std::string & name, const Json::Value & args) const {
 		//std::cout << std::endl << "CALLING " << name << " ARGS " << args << std::endl;
-		return _functions.at(name)(args);
+		return call(at(name), args);
+	}
+
+	// runs every {"function": name, "args": [...]} call of calls concurrently on pool,
+	// returns their results in the same order. returns once every call is done,
+	// then rethrows the first exception.
+	template <typename Executor>
+	Json::Value call_all(Executor & pool, const Json::Value & calls) const {
+		auto task = [this](handle h, Json::Value args) {
+			return [this,h,args] { return call(h,args); };
+		};
+		// names are resolved before anything runs
+		std::vector<handle> handles;
+		for (auto & c : calls) {
+			handles.push_back(resolve(c["function"].asString()));
+		}
+		std::vector<decltype(pool.async(task(handle(),Json::Value())))> pending;
+		for (Json::ArrayIndex i = 0; i < handles.size(); i++) {
+			pending.push_back(pool.async(task(handles[i],calls[i]["args"])));
+		}
+		for (auto & p : pending) {
+			p.wait();
+		}
+		Json::Value out(Json::arrayValue);
+		for (auto & p : pending) {
+			out.append(p.get());
+		}
+		return out;
 	}
 
 	Json::Value functions() const {
 		Json::Value out;
-		for (auto & f : _functions) {
-			out[f.first] = _parameters.at(f.first);
+		for (auto & p : _parameters) {
+			out[p.first] = p.second;
 		}
 		return out;
 	}
+
+private:
+	entry & add(const std::string & name) {
+		auto const id = _names.insert(name);
+		if(id == _functions.size()) {
+			_functions.emplace_back();
+		}
+		return _functions[id];
+	}
+
+	const entry & at(handle h) const {
+		if(h.id >= _functions.size()) {
+			throw std::out_of_range("No function for handle " + std::to_string(h.id));
+		}
+		return _functions[h.id];
+	}
+
+	handle at(const std::string & name) const {
+		auto const h = resolve(name);
+		if(!h) {
+			throw std::out_of_range("No function named " + name);
+		}
+		return h;
+	}
 };
 
 // --------------JsonRPCServer that host's json_functions--------------------
@@ -292,14 +973,15 @@ class JsonFunctionServer : public jsonrpc::AbstractServer<JsonFunctionServer>
         {
         	std::cout << "JsonFunctionServer::call REQ: " << request << " RES: " << response << std::endl;
         	auto func = static_cast<const Json::Value>(request)["__args"][0].asString();
+        	auto handle = _json_funcs.resolve(func);
 
-        	if(!_json_funcs.contains(func)) {
+        	if(!handle) {
         		std::cout << ("[CALL][IGNORED] Function named "+ func +" not found")  << std::endl;
         		return;
         	}
 
         	auto parameters = static_cast<const Json::Value>(request)["function"].asString();
-        	response = _json_funcs.call_from_string(func,parameters);
+        	response = _json_funcs.call_from_string(handle,parameters);
         	std::cout << "JsonFunctionServer::call REQ: " << request << " RES: " << response << std::endl;
         }
 
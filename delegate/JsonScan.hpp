@@ -0,0 +1,697 @@
+#pragma once
+#include <libs/delegate/Delegate.hpp>
+#include <jsoncpp/json/json.h>
+#include <cerrno>
+#include <clocale>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <locale>
+#include <sstream>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define JSON_SCAN_X86 1
+#endif
+
+//---------------------------------------------------------------------------------
+/// json_scan
+/// parses Json text into a Json::Value in two stages, after simdjson (Langdale, Lemire:
+/// Parsing gigabytes of JSON per second). the first stage classifies 64 bytes at a
+/// time with SIMD compares, validates utf-8, tracks escapes and strings with bit
+/// operations on the masks, and indexes every structural character, string and
+/// scalar outside of strings. the second stage builds the Json::Value by walking
+/// the index, without looking at the bytes in between.
+/// the first stage has scalar, SSE4.2 and AVX2 kernels; the widest one the processor
+/// runs is chosen at run time with cpuid.
+///
+/// parse_json() is the parser the delegate library and the parameters use. it takes
+/// the scanned value and falls back to Json::Reader for the text the scanner does not
+/// take, like comments. json_parser() replaces it, e.g. with json_scan::reader_parse.
+///
+///		Json::Value request;
+///		if (!parse_json(body, request)) { ... }
+//---------------------------------------------------------------------------------
+namespace json_scan {
+
+	enum class kernel { scalar, sse42, avx2 };
+
+	/// ok, text that is not utf-8, or text the scanner does not take
+	enum class status { ok, invalid_utf8, syntax };
+
+	/// the widest kernel of the processor, from cpuid
+	inline kernel best_kernel()
+	{
+		static const kernel best = [] {
+#if JSON_SCAN_X86
+			unsigned eax, ebx, ecx, edx;
+			if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_2)) {
+				return kernel::scalar;
+			}
+			// avx2 also needs the operating system to save the ymm registers
+			bool const os_avx = (ecx & bit_OSXSAVE) && (ecx & bit_AVX);
+			if (os_avx) {
+				unsigned low, high;
+				__asm__ ("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+				if ((low & 6) == 6 && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_AVX2)) {
+					return kernel::avx2;
+				}
+			}
+			return kernel::sse42;
+#else
+			return kernel::scalar;
+#endif
+		}();
+		return best;
+	}
+
+	/// character classes of a 64 byte block, one bit per byte
+	struct block_masks
+	{
+		std::uint64_t backslash;
+		std::uint64_t quote;
+		/// { } [ ] : ,
+		std::uint64_t structural;
+		std::uint64_t whitespace;
+		std::uint64_t non_ascii;
+	};
+
+	namespace detail {
+
+		enum char_class : std::uint8_t { other = 0, backslash = 1, quote = 2, structural = 4, whitespace = 8 };
+
+		inline const std::uint8_t * classes()
+		{
+			static const struct table {
+				table()
+				{
+					std::memset(c, other, sizeof(c));
+					c[std::uint8_t('\\')] = backslash;
+					c[std::uint8_t('"')] = quote;
+					for (auto s : "{}[]:,") {
+						if (s) {
+							c[std::uint8_t(s)] = structural;
+						}
+					}
+					for (auto s : " \t\n\r") {
+						if (s) {
+							c[std::uint8_t(s)] = whitespace;
+						}
+					}
+				}
+				std::uint8_t c[256];
+			} t;
+			return t.c;
+		}
+
+		struct scalar_classifier
+		{
+			void operator()(const char * p, block_masks & m) const
+			{
+				auto const table = classes();
+				m = block_masks{0, 0, 0, 0, 0};
+				for (unsigned i = 0; i < 64; i++) {
+					auto const byte = std::uint8_t(p[i]);
+					auto const c = table[byte];
+					m.backslash |= std::uint64_t(c & backslash) << i;
+					m.quote |= std::uint64_t((c & quote) >> 1) << i;
+					m.structural |= std::uint64_t((c & structural) >> 2) << i;
+					m.whitespace |= std::uint64_t((c & whitespace) >> 3) << i;
+					m.non_ascii |= std::uint64_t(byte >> 7) << i;
+				}
+			}
+		};
+
+#if JSON_SCAN_X86
+		struct sse42_classifier
+		{
+			__attribute__((target("sse4.2")))
+			void operator()(const char * p, block_masks & m) const
+			{
+				auto const structural_set = _mm_setr_epi8('{', '}', '[', ']', ':', ',', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+				auto const whitespace_set = _mm_setr_epi8(' ', '\t', '\n', '\r', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+				auto const backslashes = _mm_set1_epi8('\\');
+				auto const quotes = _mm_set1_epi8('"');
+				const int any = _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK;
+				m = block_masks{0, 0, 0, 0, 0};
+				for (unsigned i = 0; i < 4; i++) {
+					auto const bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * i));
+					auto const shift = 16 * i;
+					m.structural |= std::uint64_t(std::uint16_t(_mm_cvtsi128_si32(_mm_cmpestrm(structural_set, 6, bytes, 16, any)))) << shift;
+					m.whitespace |= std::uint64_t(std::uint16_t(_mm_cvtsi128_si32(_mm_cmpestrm(whitespace_set, 4, bytes, 16, any)))) << shift;
+					m.backslash |= std::uint64_t(std::uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, backslashes)))) << shift;
+					m.quote |= std::uint64_t(std::uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, quotes)))) << shift;
+					m.non_ascii |= std::uint64_t(std::uint16_t(_mm_movemask_epi8(bytes))) << shift;
+				}
+			}
+		};
+
+		struct avx2_classifier
+		{
+			__attribute__((target("avx2")))
+			static std::uint64_t any(__m256i low, __m256i high, char c)
+			{
+				auto const v = _mm256_set1_epi8(c);
+				return std::uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, v)))
+					| std::uint64_t(std::uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, v)))) << 32;
+			}
+
+			__attribute__((target("avx2")))
+			void operator()(const char * p, block_masks & m) const
+			{
+				auto const low = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+				auto const high = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32));
+				m.backslash = any(low, high, '\\');
+				m.quote = any(low, high, '"');
+				m.structural = any(low, high, '{') | any(low, high, '}') | any(low, high, '[')
+					| any(low, high, ']') | any(low, high, ':') | any(low, high, ',');
+				m.whitespace = any(low, high, ' ') | any(low, high, '\t') | any(low, high, '\n') | any(low, high, '\r');
+				m.non_ascii = std::uint32_t(_mm256_movemask_epi8(low))
+					| std::uint64_t(std::uint32_t(_mm256_movemask_epi8(high))) << 32;
+			}
+		};
+#endif
+
+		/// first stage: turns the masks of consecutive blocks into positions
+		class indexer
+		{
+		public:
+			explicit indexer(std::vector<std::uint32_t> & positions) :_positions(positions) {}
+
+			bool add(const char * bytes, const block_masks & m, std::uint32_t offset)
+			{
+				if ((m.non_ascii || _continuations) && !validate(bytes, m.non_ascii)) {
+					return false;
+				}
+				auto const quotes = m.quote & ~escapes(m.backslash);
+				// from an opening quote up to the byte before its closing quote
+				auto const in_string = prefix_xor(quotes) ^ _in_string;
+				_in_string = std::uint64_t(std::int64_t(in_string) >> 63);
+				auto const scalar = ~(m.structural | m.whitespace | m.quote | in_string);
+				auto const scalar_starts = scalar & ~((scalar << 1) | _scalar);
+				_scalar = scalar >> 63;
+				auto bits = (m.structural & ~in_string) | (quotes & in_string) | scalar_starts;
+				while (bits) {
+					_positions.push_back(offset + unsigned(__builtin_ctzll(bits)));
+					bits &= bits - 1;
+				}
+				return true;
+			}
+
+			status finish() const
+			{
+				if (_continuations) {
+					return status::invalid_utf8;
+				}
+				return _in_string ? status::syntax : status::ok;
+			}
+
+		private:
+			static std::uint64_t prefix_xor(std::uint64_t x)
+			{
+				x ^= x << 1;
+				x ^= x << 2;
+				x ^= x << 4;
+				x ^= x << 8;
+				x ^= x << 16;
+				x ^= x << 32;
+				return x;
+			}
+
+			// bytes following an unescaped backslash. backslashes are rare: visit each
+			std::uint64_t escapes(std::uint64_t backslash)
+			{
+				auto escaped = _escape;
+				backslash &= ~_escape;
+				_escape = 0;
+				while (backslash) {
+					auto const i = unsigned(__builtin_ctzll(backslash));
+					if (i == 63) {
+						_escape = 1;
+						break;
+					}
+					escaped |= std::uint64_t(2) << i;
+					backslash &= ~(std::uint64_t(3) << i);
+				}
+				return escaped;
+			}
+
+			// utf-8 sequences of the block, which may continue those of the previous block
+			bool validate(const char * bytes, std::uint64_t non_ascii)
+			{
+				unsigned i = 0;
+				if (!_continuations) {
+					i = unsigned(__builtin_ctzll(non_ascii));
+				}
+				for (; i < 64; i++) {
+					auto const c = std::uint8_t(bytes[i]);
+					if (_continuations) {
+						if (c < _low || c > _high) {
+							return false;
+						}
+						_low = 0x80;
+						_high = 0xBF;
+						_continuations--;
+						continue;
+					}
+					if (c < 0x80) {
+						auto const rest = i == 63 ? 0 : non_ascii & ~((std::uint64_t(2) << i) - 1);
+						if (!rest) {
+							return true;
+						}
+						i = unsigned(__builtin_ctzll(rest)) - 1;
+					} else if (c >= 0xC2 && c <= 0xDF) {
+						_continuations = 1;
+					} else if (c == 0xE0) {
+						_continuations = 2;
+						_low = 0xA0;
+					} else if ((c >= 0xE1 && c <= 0xEC) || c == 0xEE || c == 0xEF) {
+						_continuations = 2;
+					} else if (c == 0xED) {
+						// no surrogates
+						_continuations = 2;
+						_high = 0x9F;
+					} else if (c == 0xF0) {
+						_continuations = 3;
+						_low = 0x90;
+					} else if (c >= 0xF1 && c <= 0xF3) {
+						_continuations = 3;
+					} else if (c == 0xF4) {
+						_continuations = 3;
+						_high = 0x8F;
+					} else {
+						return false;
+					}
+				}
+				return true;
+			}
+
+			std::vector<std::uint32_t> & _positions;
+			std::uint64_t _in_string = 0;
+			std::uint64_t _scalar = 0;
+			std::uint64_t _escape = 0;
+			unsigned _continuations = 0;
+			std::uint8_t _low = 0x80;
+			std::uint8_t _high = 0xBF;
+		};
+
+		template <typename Classifier>
+		status index(const std::string & text, std::vector<std::uint32_t> & positions, Classifier classify)
+		{
+			indexer blocks(positions);
+			auto const p = text.data();
+			auto const n = text.size();
+			block_masks m;
+			std::size_t i = 0;
+			for (; i + 64 <= n; i += 64) {
+				classify(p + i, m);
+				if (!blocks.add(p + i, m, std::uint32_t(i))) {
+					return status::invalid_utf8;
+				}
+			}
+			// the last block is padded with whitespace
+			char last[64];
+			std::memset(last, ' ', sizeof(last));
+			std::memcpy(last, p + i, n - i);
+			classify(last, m);
+			if (!blocks.add(last, m, std::uint32_t(i))) {
+				return status::invalid_utf8;
+			}
+			return blocks.finish();
+		}
+
+		/// converts the length bytes of a terminated number the way the "C" locale does,
+		/// whatever the locale of the program. false when they are not all taken or overflow.
+		inline bool to_double(const char * text, std::size_t length, double & d)
+		{
+#if defined(__GLIBC__)
+			static const locale_t c_numeric = newlocale(LC_NUMERIC_MASK, "C", locale_t(0));
+			if (c_numeric) {
+				char * stop;
+				errno = 0;
+				d = strtod_l(text, &stop, c_numeric);
+				return stop == text + length && errno != ERANGE;
+			}
+#endif
+			std::istringstream in(std::string(text, length));
+			in.imbue(std::locale::classic());
+			in >> d;
+			return !in.fail() && in.peek() == std::char_traits<char>::eof();
+		}
+
+		/// second stage: builds the value from the positions
+		class builder
+		{
+		public:
+			builder(const std::string & text, const std::vector<std::uint32_t> & positions)
+			:_text(text.data())
+			,_size(text.size())
+			,_positions(positions)
+			{}
+
+			bool document(Json::Value & out)
+			{
+				return value(out, 0) && _i == _positions.size();
+			}
+
+		private:
+			// the nesting Json::Reader allows
+			static const unsigned max_depth = 1000;
+
+			char current() const { return _text[_positions[_i]]; }
+
+			bool next_is(char c)
+			{
+				if (_i < _positions.size() && current() == c) {
+					_i++;
+					return true;
+				}
+				return false;
+			}
+
+			bool value(Json::Value & out, unsigned depth)
+			{
+				if (_i == _positions.size() || depth > max_depth) {
+					return false;
+				}
+				switch (current()) {
+				case '{': return object(out, depth);
+				case '[': return array(out, depth);
+				case '"':
+					if (!string(_string)) {
+						return false;
+					}
+					out = Json::Value(_string);
+					return true;
+				default: return scalar(out);
+				}
+			}
+
+			bool object(Json::Value & out, unsigned depth)
+			{
+				out = Json::Value(Json::objectValue);
+				_i++;
+				if (next_is('}')) {
+					return true;
+				}
+				for (;;) {
+					if (_i == _positions.size() || current() != '"' || !string(_key) || !next_is(':')) {
+						return false;
+					}
+					if (!value(out[_key], depth + 1)) {
+						return false;
+					}
+					if (!next_is(',')) {
+						return next_is('}');
+					}
+				}
+			}
+
+			bool array(Json::Value & out, unsigned depth)
+			{
+				out = Json::Value(Json::arrayValue);
+				_i++;
+				if (next_is(']')) {
+					return true;
+				}
+				for (;;) {
+					if (!value(out[out.size()], depth + 1)) {
+						return false;
+					}
+					if (!next_is(',')) {
+						return next_is(']');
+					}
+				}
+			}
+
+			// the first stage found the closing quote
+			bool string(std::string & s)
+			{
+				auto p = _text + _positions[_i++] + 1;
+				s.clear();
+				for (;;) {
+					auto const run = p;
+					while (*p != '"' && *p != '\\' && std::uint8_t(*p) >= 0x20) {
+						p++;
+					}
+					s.append(run, p);
+					if (*p == '"') {
+						return true;
+					}
+					if (*p != '\\') {
+						return false;
+					}
+					p++;
+					switch (*p++) {
+					case '"': s += '"'; break;
+					case '\\': s += '\\'; break;
+					case '/': s += '/'; break;
+					case 'b': s += '\b'; break;
+					case 'f': s += '\f'; break;
+					case 'n': s += '\n'; break;
+					case 'r': s += '\r'; break;
+					case 't': s += '\t'; break;
+					case 'u': if (!unicode(p, s)) { return false; } break;
+					default: return false;
+					}
+				}
+			}
+
+			static bool hex4(const char *& p, unsigned & code)
+			{
+				code = 0;
+				for (int i = 0; i < 4; i++) {
+					auto const c = *p++;
+					code <<= 4;
+					if (c >= '0' && c <= '9') code |= unsigned(c - '0');
+					else if (c >= 'a' && c <= 'f') code |= unsigned(c - 'a' + 10);
+					else if (c >= 'A' && c <= 'F') code |= unsigned(c - 'A' + 10);
+					else return false;
+				}
+				return true;
+			}
+
+			// \uXXXX, with surrogate pairs, appended as utf-8
+			static bool unicode(const char *& p, std::string & s)
+			{
+				unsigned code;
+				if (!hex4(p, code)) {
+					return false;
+				}
+				if (code >= 0xD800 && code <= 0xDBFF) {
+					unsigned low;
+					if (p[0] != '\\' || p[1] != 'u') {
+						return false;
+					}
+					p += 2;
+					if (!hex4(p, low) || low < 0xDC00 || low > 0xDFFF) {
+						return false;
+					}
+					code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+				} else if (code >= 0xDC00 && code <= 0xDFFF) {
+					return false;
+				}
+				if (code < 0x80) {
+					s += char(code);
+				} else if (code < 0x800) {
+					s += char(0xC0 | (code >> 6));
+					s += char(0x80 | (code & 0x3F));
+				} else if (code < 0x10000) {
+					s += char(0xE0 | (code >> 12));
+					s += char(0x80 | ((code >> 6) & 0x3F));
+					s += char(0x80 | (code & 0x3F));
+				} else {
+					s += char(0xF0 | (code >> 18));
+					s += char(0x80 | ((code >> 12) & 0x3F));
+					s += char(0x80 | ((code >> 6) & 0x3F));
+					s += char(0x80 | (code & 0x3F));
+				}
+				return true;
+			}
+
+			bool scalar(Json::Value & out)
+			{
+				auto const begin = _text + _positions[_i++];
+				auto end = begin;
+				auto const table = classes();
+				while (end < _text + _size && !table[std::uint8_t(*end)]) {
+					end++;
+				}
+				auto const length = std::size_t(end - begin);
+				if (length == 4 && !std::memcmp(begin, "true", 4)) {
+					out = Json::Value(true);
+					return true;
+				}
+				if (length == 5 && !std::memcmp(begin, "false", 5)) {
+					out = Json::Value(false);
+					return true;
+				}
+				if (length == 4 && !std::memcmp(begin, "null", 4)) {
+					out = Json::Value();
+					return true;
+				}
+				return number(begin, end, out);
+			}
+
+			// integers as Json::Reader decodes them: int up to the range of int,
+			// unsigned above, double when they overflow 64 bits or have a fraction or exponent
+			static bool number(const char * begin, const char * end, Json::Value & out)
+			{
+				auto p = begin;
+				bool const negative = p < end && *p == '-';
+				if (negative) {
+					p++;
+				}
+				auto const digits = p;
+				std::uint64_t magnitude = 0;
+				bool overflow = false;
+				while (p < end && *p >= '0' && *p <= '9') {
+					auto const digit = std::uint64_t(*p - '0');
+					overflow = overflow || magnitude > (UINT64_MAX - digit) / 10;
+					magnitude = magnitude * 10 + digit;
+					p++;
+				}
+				if (p == digits || (*digits == '0' && p - digits > 1)) {
+					return false;
+				}
+				bool integer = true;
+				if (p < end && *p == '.') {
+					integer = false;
+					auto const fraction = ++p;
+					while (p < end && *p >= '0' && *p <= '9') {
+						p++;
+					}
+					if (p == fraction) {
+						return false;
+					}
+				}
+				if (p < end && (*p == 'e' || *p == 'E')) {
+					integer = false;
+					p++;
+					if (p < end && (*p == '+' || *p == '-')) {
+						p++;
+					}
+					auto const exponent = p;
+					while (p < end && *p >= '0' && *p <= '9') {
+						p++;
+					}
+					if (p == exponent) {
+						return false;
+					}
+				}
+				if (p != end) {
+					return false;
+				}
+				if (integer && !overflow) {
+					if (negative) {
+						if (magnitude > std::uint64_t(INT64_MAX) + 1) {
+							integer = false;
+						} else {
+							out = Json::Value(Json::Int64(0 - magnitude));
+							return true;
+						}
+					} else if (magnitude <= std::uint64_t(INT32_MAX)) {
+						out = Json::Value(Json::Int64(magnitude));
+						return true;
+					} else {
+						out = Json::Value(Json::UInt64(magnitude));
+						return true;
+					}
+				}
+				// the conversion needs a terminated copy
+				char buffer[64];
+				if (std::size_t(end - begin) >= sizeof(buffer)) {
+					return false;
+				}
+				std::memcpy(buffer, begin, end - begin);
+				buffer[end - begin] = 0;
+				double d;
+				if (!to_double(buffer, end - begin, d)) {
+					return false;
+				}
+				out = Json::Value(d);
+				return true;
+			}
+
+			const char * const _text;
+			const std::size_t _size;
+			const std::vector<std::uint32_t> & _positions;
+			std::size_t _i = 0;
+			std::string _key;
+			std::string _string;
+		};
+	}
+
+	/// indexes the structural characters outside strings, the opening quotes and
+	/// the first byte of the other scalars of text. k is lowered to what the processor runs.
+	inline status index(const std::string & text, std::vector<std::uint32_t> & positions, kernel k = best_kernel())
+	{
+		positions.clear();
+		if (text.size() > UINT32_MAX) {
+			return status::syntax;
+		}
+		if (k > best_kernel()) {
+			k = best_kernel();
+		}
+#if JSON_SCAN_X86
+		if (k == kernel::avx2) {
+			return detail::index(text, positions, detail::avx2_classifier());
+		}
+		if (k == kernel::sse42) {
+			return detail::index(text, positions, detail::sse42_classifier());
+		}
+#endif
+		return detail::index(text, positions, detail::scalar_classifier());
+	}
+
+	inline status parse(const std::string & text, Json::Value & out, kernel k = best_kernel())
+	{
+		// the index of each thread is reused, unless a large text made it large
+		static thread_local std::vector<std::uint32_t> positions;
+		auto result = index(text, positions, k);
+		if (result == status::ok) {
+			Json::Value root;
+			if (detail::builder(text, positions).document(root)) {
+				out.swap(root);
+			} else {
+				result = status::syntax;
+			}
+		}
+		if (positions.capacity() > (1u << 16)) {
+			std::vector<std::uint32_t>().swap(positions);
+		}
+		return result;
+	}
+
+	/// Json::Reader as a parser
+	inline bool reader_parse(const std::string & text, Json::Value & out)
+	{
+		return Json::Reader().parse(text, out);
+	}
+
+	/// the scanner, then Json::Reader for the text it does not take. invalid utf-8 fails.
+	inline bool scan_parse(const std::string & text, Json::Value & out)
+	{
+		switch (parse(text, out)) {
+		case status::ok: return true;
+		case status::invalid_utf8: return false;
+		default: return reader_parse(text, out);
+		}
+	}
+}
+
+using json_parse_function = delegate<bool(const std::string &, Json::Value &)>;
+
+/// the parser of parse_json. replace it before other threads parse.
+inline json_parse_function & json_parser()
+{
+	static json_parse_function parser = json_parse_function::from<&json_scan::scan_parse>();
+	return parser;
+}
+
+inline bool parse_json(const std::string & text, Json::Value & out)
+{
+	return json_parser()(text, out);
+}
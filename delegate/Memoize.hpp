@@ -0,0 +1,248 @@
+#pragma once
+#include <libs/delegate/Delegate.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+namespace memoize_detail {
+
+	inline void hash_combine(std::size_t & seed, std::size_t value)
+	{
+		seed ^= value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+	}
+
+	template <typename Tuple, std::size_t... I>
+	std::size_t hash_tuple(Tuple const & t, std::index_sequence<I...>)
+	{
+		std::size_t seed = std::tuple_size<Tuple>::value;
+		int expand[] = { 0, (hash_combine(seed, std::hash<std::tuple_element_t<I,Tuple>>()(std::get<I>(t))), 0)... };
+		(void)expand;
+		return seed;
+	}
+
+	/// std::hash of every element, combined
+	struct tuple_hash
+	{
+		template <typename... T>
+		std::size_t operator()(std::tuple<T...> const & t) const
+		{
+			return hash_tuple(t, std::index_sequence_for<T...>());
+		}
+	};
+
+	struct counters
+	{
+		std::atomic<std::uint64_t> hits{0};
+		std::atomic<std::uint64_t> misses{0};
+		std::atomic<std::uint64_t> evictions{0};
+	};
+
+	//---------------------------------------------------------------------------------
+	/// bounded cache split into independently locked shards.
+	/// each shard evicts with the CLOCK algorithm: a hit only sets a reference bit,
+	/// and the hand clears bits until it finds an entry not used since its last pass.
+	/// values are shared_futures, so the first caller of a key computes it outside
+	/// the lock while later callers of the same key wait for that one result.
+	//---------------------------------------------------------------------------------
+	template <typename Key, typename Value>
+	class cache
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+
+		cache(std::size_t capacity, std::size_t shard_count, clock::duration ttl, std::shared_ptr<counters> stats)
+		:_shards(shard_count ? shard_count : 1)
+		,_ttl(ttl)
+		,_stats(std::move(stats))
+		{
+			auto const per_shard = (capacity + _shards.size() - 1) / _shards.size();
+			for (auto & s : _shards) {
+				s.capacity = per_shard ? per_shard : 1;
+				s.index.reserve(s.capacity);
+				s.slots.reserve(s.capacity);
+			}
+		}
+
+		template <typename Compute>
+		Value get(Key const & key, Compute compute)
+		{
+			auto const hash = tuple_hash()(key);
+			auto & s = _shards[hash % _shards.size()];
+			std::promise<Value> promise;
+			std::shared_future<Value> result;
+			{
+				std::lock_guard<std::mutex> lock(s.mutex);
+				auto found = s.index.find(key);
+				if (found != s.index.end()) {
+					auto & slot = s.slots[found->second];
+					if (!expired(slot)) {
+						slot.referenced = true;
+						result = slot.value;
+					} else {
+						slot.value = promise.get_future().share();
+						slot.expires = expiry();
+						slot.referenced = true;
+					}
+				} else {
+					s.insert(key, promise.get_future().share(), expiry(), *_stats);
+				}
+			}
+
+			if (result.valid()) {
+				_stats->hits.fetch_add(1, std::memory_order_relaxed);
+				return result.get();
+			}
+
+			_stats->misses.fetch_add(1, std::memory_order_relaxed);
+			try {
+				Value value = compute();
+				promise.set_value(value);
+				return value;
+			} catch (...) {
+				// waiters see the exception, later callers compute again
+				promise.set_exception(std::current_exception());
+				s.erase(key);
+				throw;
+			}
+		}
+
+	private:
+		struct slot
+		{
+			Key key;
+			std::shared_future<Value> value;
+			clock::time_point expires;
+			bool referenced;
+		};
+
+		struct shard
+		{
+			std::mutex mutex;
+			std::unordered_map<Key, std::size_t, tuple_hash> index;
+			std::vector<slot> slots;
+			// slots of erased keys, reused before the hand evicts
+			std::vector<std::size_t> free;
+			std::size_t hand = 0;
+			std::size_t capacity = 0;
+
+			void insert(Key const & key, std::shared_future<Value> value, clock::time_point expires, counters & stats)
+			{
+				if (!free.empty()) {
+					auto const reused = free.back();
+					free.pop_back();
+					slots[reused] = slot{key, std::move(value), expires, false};
+					index.emplace(key, reused);
+					return;
+				}
+				if (slots.size() < capacity) {
+					index.emplace(key, slots.size());
+					slots.push_back(slot{key, std::move(value), expires, false});
+					return;
+				}
+				while (slots[hand].referenced) {
+					slots[hand].referenced = false;
+					hand = (hand + 1) % slots.size();
+				}
+				auto & victim = slots[hand];
+				index.erase(victim.key);
+				stats.evictions.fetch_add(1, std::memory_order_relaxed);
+				victim = slot{key, std::move(value), expires, false};
+				index.emplace(key, hand);
+				hand = (hand + 1) % slots.size();
+			}
+
+			void erase(Key const & key)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				auto found = index.find(key);
+				if (found == index.end()) {
+					return;
+				}
+				// the next insert takes the slot before the hand evicts another
+				auto & s = slots[found->second];
+				s.value = std::shared_future<Value>();
+				s.referenced = false;
+				free.push_back(found->second);
+				index.erase(found);
+			}
+		};
+
+		bool expired(slot const & s) const
+		{
+			return s.expires != clock::time_point::max() && clock::now() >= s.expires;
+		}
+
+		clock::time_point expiry() const
+		{
+			return _ttl == clock::duration::zero() ? clock::time_point::max() : clock::now() + _ttl;
+		}
+
+		std::vector<shard> _shards;
+		clock::duration _ttl;
+		std::shared_ptr<counters> _stats;
+	};
+}
+
+//---------------------------------------------------------------------------------
+/// memoize aspect
+/// caches the results of a pure delegate, keyed on its decayed argument tuple,
+/// which must be copyable, equality comparable and std::hash-able.
+/// every delegate wrapped by one memoize gets its own cache of at most capacity
+/// entries, but they share the hit, miss and eviction counters.
+/// with a ttl, entries older than ttl are computed again.
+///
+///		memoize cached(4096, std::chrono::seconds(30));
+///		functions.add_function("score", cached(make_delegate(&score)));
+//---------------------------------------------------------------------------------
+class memoize
+{
+public:
+	struct stats
+	{
+		std::uint64_t hits;
+		std::uint64_t misses;
+		std::uint64_t evictions;
+	};
+
+	explicit memoize(std::size_t capacity = 1024,
+			std::chrono::steady_clock::duration ttl = std::chrono::steady_clock::duration::zero(),
+			std::size_t shards = 16)
+	:_capacity(capacity)
+	,_ttl(ttl)
+	,_shards(shards)
+	,_counters(std::make_shared<memoize_detail::counters>())
+	{}
+
+	template<typename R, typename... Args>
+	delegate<R(Args...)> operator () (delegate<R(Args...)> f) const
+	{
+		static_assert(!std::is_void<R>::value && !std::is_reference<R>::value, "memoize caches results by value");
+		using key_type = std::tuple<std::decay_t<Args>...>;
+		using cache_type = memoize_detail::cache<key_type, std::decay_t<R>>;
+		auto cache = std::make_shared<cache_type>(_capacity, _shards, _ttl, _counters);
+		return [cache,f](delegate_param_t<Args>... args) -> R
+		{
+			return cache->get(key_type(args...), [&] { return f(args...); });
+		};
+	}
+
+	stats statistics() const
+	{
+		return { _counters->hits.load(std::memory_order_relaxed),
+				_counters->misses.load(std::memory_order_relaxed),
+				_counters->evictions.load(std::memory_order_relaxed) };
+	}
+
+private:
+	std::size_t _capacity;
+	std::chrono::steady_clock::duration _ttl;
+	std::size_t _shards;
+	std::shared_ptr<memoize_detail::counters> _counters;
+};
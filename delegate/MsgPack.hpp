@@ -0,0 +1,456 @@
+#pragma once
+#include <jsoncpp/json/json.h>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+//---------------------------------------------------------------------------------
+/// msgpack_codec
+/// reads and writes MessagePack (https://msgpack.org), the binary encoding of the
+/// calls between services. numbers keep their binary form: integers take the
+/// fewest bytes that hold them and floats are written as IEEE 754, so nothing is
+/// printed and parsed again. strings are utf-8 bytes, maps have string keys;
+/// extension types are not read.
+///
+/// reader and writer work on the elements of a byte string without building a
+/// Json::Value. decode() and encode() convert whole values to and from Json::Value
+/// for the functions that take Json.
+///
+///		auto request = msgpack_codec::pack(9, "abc", 1.5);
+///		auto reply = functions.call_binary("describe", request);
+//---------------------------------------------------------------------------------
+namespace msgpack_codec {
+
+	/// the kind of an element. integers that fit an int64 are signed.
+	enum class kind { nil, boolean, integer, unsigned_integer, floating, string, binary, array, map };
+
+	/// one element. strings and binaries point into the bytes being read;
+	/// arrays and maps hold the number of their elements, which follow them.
+	struct object
+	{
+		kind type = kind::nil;
+		bool boolean = false;
+		std::int64_t integer = 0;
+		std::uint64_t unsigned_integer = 0;
+		double floating = 0;
+		const char * data = nullptr;
+		std::uint32_t size = 0;
+	};
+
+	class reader
+	{
+	public:
+		explicit reader(const std::string & bytes) :_p(bytes.data()), _end(bytes.data() + bytes.size()) {}
+
+		bool at_end() const { return _p == _end; }
+
+		/// reads the header of the next element
+		bool next(object & o)
+		{
+			if (_p == _end) {
+				return false;
+			}
+			auto const c = std::uint8_t(*_p++);
+			if (c <= 0x7f) {
+				return integer(o, c);
+			}
+			if (c >= 0xe0) {
+				return integer(o, std::int8_t(c));
+			}
+			if (c <= 0x8f) {
+				return container(o, kind::map, c & 0x0f);
+			}
+			if (c <= 0x9f) {
+				return container(o, kind::array, c & 0x0f);
+			}
+			if (c <= 0xbf) {
+				return bytes(o, kind::string, c & 0x1f);
+			}
+			switch (c) {
+			case 0xc0: o.type = kind::nil; return true;
+			case 0xc2: o.type = kind::boolean; o.boolean = false; return true;
+			case 0xc3: o.type = kind::boolean; o.boolean = true; return true;
+			case 0xc4: return sized<std::uint8_t>(o, kind::binary);
+			case 0xc5: return sized<std::uint16_t>(o, kind::binary);
+			case 0xc6: return sized<std::uint32_t>(o, kind::binary);
+			case 0xca: {
+				std::uint32_t bits;
+				float f;
+				if (!big_endian(bits)) {
+					return false;
+				}
+				std::memcpy(&f, &bits, sizeof(f));
+				o.type = kind::floating;
+				o.floating = f;
+				return true;
+			}
+			case 0xcb: {
+				std::uint64_t bits;
+				if (!big_endian(bits)) {
+					return false;
+				}
+				std::memcpy(&o.floating, &bits, sizeof(o.floating));
+				o.type = kind::floating;
+				return true;
+			}
+			case 0xcc: return unsigned_value<std::uint8_t>(o);
+			case 0xcd: return unsigned_value<std::uint16_t>(o);
+			case 0xce: return unsigned_value<std::uint32_t>(o);
+			case 0xcf: return unsigned_value<std::uint64_t>(o);
+			case 0xd0: return signed_value<std::int8_t, std::uint8_t>(o);
+			case 0xd1: return signed_value<std::int16_t, std::uint16_t>(o);
+			case 0xd2: return signed_value<std::int32_t, std::uint32_t>(o);
+			case 0xd3: return signed_value<std::int64_t, std::uint64_t>(o);
+			case 0xd9: return sized<std::uint8_t>(o, kind::string);
+			case 0xda: return sized<std::uint16_t>(o, kind::string);
+			case 0xdb: return sized<std::uint32_t>(o, kind::string);
+			case 0xdc: return sized<std::uint16_t>(o, kind::array);
+			case 0xdd: return sized<std::uint32_t>(o, kind::array);
+			case 0xde: return sized<std::uint16_t>(o, kind::map);
+			case 0xdf: return sized<std::uint32_t>(o, kind::map);
+			default: return false;
+			}
+		}
+
+		/// reads over the next element and the elements it contains
+		bool skip(unsigned depth = 0)
+		{
+			object o;
+			if (depth > max_depth || !next(o)) {
+				return false;
+			}
+			if (o.type == kind::array || o.type == kind::map) {
+				std::uint64_t const n = o.type == kind::map ? 2 * std::uint64_t(o.size) : o.size;
+				for (std::uint64_t i = 0; i < n; i++) {
+					if (!skip(depth + 1)) {
+						return false;
+					}
+				}
+			}
+			return true;
+		}
+
+		/// the nesting Json::Reader allows
+		static const unsigned max_depth = 1000;
+
+	private:
+		template <typename U>
+		bool big_endian(U & v)
+		{
+			if (std::size_t(_end - _p) < sizeof(U)) {
+				return false;
+			}
+			v = 0;
+			for (std::size_t i = 0; i < sizeof(U); i++) {
+				v = U(v << 8) | std::uint8_t(_p[i]);
+			}
+			_p += sizeof(U);
+			return true;
+		}
+
+		static bool integer(object & o, std::int64_t v)
+		{
+			o.type = kind::integer;
+			o.integer = v;
+			return true;
+		}
+
+		template <typename U>
+		bool unsigned_value(object & o)
+		{
+			U v;
+			if (!big_endian(v)) {
+				return false;
+			}
+			if (std::uint64_t(v) > std::uint64_t(std::numeric_limits<std::int64_t>::max())) {
+				o.type = kind::unsigned_integer;
+				o.unsigned_integer = v;
+				return true;
+			}
+			return integer(o, std::int64_t(v));
+		}
+
+		template <typename S, typename U>
+		bool signed_value(object & o)
+		{
+			U v;
+			if (!big_endian(v)) {
+				return false;
+			}
+			return integer(o, S(v));
+		}
+
+		template <typename U>
+		bool sized(object & o, kind k)
+		{
+			U n;
+			if (!big_endian(n)) {
+				return false;
+			}
+			if (k == kind::array || k == kind::map) {
+				return container(o, k, n);
+			}
+			return bytes(o, k, n);
+		}
+
+		bool container(object & o, kind k, std::uint32_t n)
+		{
+			// every element takes a byte at least
+			if (std::size_t(_end - _p) < n) {
+				return false;
+			}
+			o.type = k;
+			o.size = n;
+			return true;
+		}
+
+		bool bytes(object & o, kind k, std::uint32_t n)
+		{
+			if (std::size_t(_end - _p) < n) {
+				return false;
+			}
+			o.type = k;
+			o.data = _p;
+			o.size = n;
+			_p += n;
+			return true;
+		}
+
+		const char * _p;
+		const char * const _end;
+	};
+
+	/// appends elements to a byte string
+	class writer
+	{
+	public:
+		explicit writer(std::string & out) :_out(out) {}
+
+		void nil() { _out += char(0xc0); }
+
+		void write(bool v) { _out += char(v ? 0xc3 : 0xc2); }
+
+		template <typename T>
+		std::enable_if_t<std::is_integral<T>::value && std::is_signed<T>::value> write(T v)
+		{
+			auto const i = std::int64_t(v);
+			if (i >= 0) {
+				unsigned_integer(std::uint64_t(i));
+			} else if (i >= -32) {
+				_out += char(std::uint8_t(i));
+			} else if (i >= std::numeric_limits<std::int8_t>::min()) {
+				header(0xd0, std::uint8_t(i));
+			} else if (i >= std::numeric_limits<std::int16_t>::min()) {
+				header(0xd1, std::uint16_t(i));
+			} else if (i >= std::numeric_limits<std::int32_t>::min()) {
+				header(0xd2, std::uint32_t(i));
+			} else {
+				header(0xd3, std::uint64_t(i));
+			}
+		}
+
+		template <typename T>
+		std::enable_if_t<std::is_integral<T>::value && !std::is_signed<T>::value> write(T v)
+		{
+			unsigned_integer(std::uint64_t(v));
+		}
+
+		void write(float v)
+		{
+			std::uint32_t bits;
+			std::memcpy(&bits, &v, sizeof(bits));
+			header(0xca, bits);
+		}
+
+		void write(double v)
+		{
+			std::uint64_t bits;
+			std::memcpy(&bits, &v, sizeof(bits));
+			header(0xcb, bits);
+		}
+
+		void write(const char * v) { write(v, std::strlen(v)); }
+		void write(const std::string & v) { write(v.data(), v.size()); }
+
+		void write(const char * data, std::size_t size)
+		{
+			if (size < 32) {
+				_out += char(0xa0 | size);
+			} else {
+				sized(0xd9, size);
+			}
+			_out.append(data, size);
+		}
+
+		void binary(const char * data, std::size_t size)
+		{
+			sized(0xc4, size);
+			_out.append(data, size);
+		}
+
+		/// the header of an array, followed by its n elements
+		void array(std::uint32_t n) { container(0x90, 0xdc, n); }
+
+		/// the header of a map, followed by n keys, each with its value
+		void map(std::uint32_t n) { container(0x80, 0xde, n); }
+
+		/// any Json::Value, e.g. the result of a function
+		void write(const Json::Value & v)
+		{
+			switch (v.type()) {
+			case Json::nullValue: nil(); break;
+			case Json::booleanValue: write(v.asBool()); break;
+			case Json::intValue: write(v.asInt64()); break;
+			case Json::uintValue: write(v.asUInt64()); break;
+			case Json::realValue: write(v.asDouble()); break;
+			case Json::stringValue: {
+				const char * begin;
+				const char * end;
+				v.getString(&begin, &end);
+				write(begin, std::size_t(end - begin));
+				break;
+			}
+			case Json::arrayValue:
+				array(v.size());
+				for (auto & element : v) {
+					write(element);
+				}
+				break;
+			case Json::objectValue:
+				map(v.size());
+				for (auto i = v.begin(); i != v.end(); ++i) {
+					write(i.name());
+					write(*i);
+				}
+				break;
+			}
+		}
+
+	private:
+		template <typename U>
+		void header(std::uint8_t code, U v)
+		{
+			char bytes[1 + sizeof(U)];
+			bytes[0] = char(code);
+			for (std::size_t i = sizeof(U); i > 0; i--) {
+				bytes[i] = char(v & 0xff);
+				v = U(v >> 8);
+			}
+			_out.append(bytes, sizeof(bytes));
+		}
+
+		void unsigned_integer(std::uint64_t v)
+		{
+			if (v <= 0x7f) {
+				_out += char(v);
+			} else if (v <= 0xff) {
+				header(0xcc, std::uint8_t(v));
+			} else if (v <= 0xffff) {
+				header(0xcd, std::uint16_t(v));
+			} else if (v <= 0xffffffff) {
+				header(0xce, std::uint32_t(v));
+			} else {
+				header(0xcf, v);
+			}
+		}
+
+		// code is the 8 bit form, code + 1 and code + 2 the 16 and 32 bit forms
+		void sized(std::uint8_t code, std::size_t size)
+		{
+			if (size <= 0xff) {
+				header(code, std::uint8_t(size));
+			} else if (size <= 0xffff) {
+				header(code + 1, std::uint16_t(size));
+			} else {
+				header(code + 2, std::uint32_t(size));
+			}
+		}
+
+		void container(std::uint8_t fixed, std::uint8_t code, std::uint32_t n)
+		{
+			if (n < 16) {
+				_out += char(fixed | n);
+			} else if (n <= 0xffff) {
+				header(code, std::uint16_t(n));
+			} else {
+				header(code + 1, n);
+			}
+		}
+
+		std::string & _out;
+	};
+
+	namespace detail {
+
+		inline bool decode(reader & in, Json::Value & out, unsigned depth)
+		{
+			object o;
+			if (depth > reader::max_depth || !in.next(o)) {
+				return false;
+			}
+			switch (o.type) {
+			case kind::nil: out = Json::Value(); return true;
+			case kind::boolean: out = Json::Value(o.boolean); return true;
+			case kind::integer: out = Json::Value(Json::Int64(o.integer)); return true;
+			case kind::unsigned_integer: out = Json::Value(Json::UInt64(o.unsigned_integer)); return true;
+			case kind::floating: out = Json::Value(o.floating); return true;
+			case kind::string:
+			case kind::binary: out = Json::Value(o.data, o.data + o.size); return true;
+			case kind::array:
+				out = Json::Value(Json::arrayValue);
+				for (std::uint32_t i = 0; i < o.size; i++) {
+					if (!decode(in, out[Json::ArrayIndex(i)], depth + 1)) {
+						return false;
+					}
+				}
+				return true;
+			case kind::map: {
+				out = Json::Value(Json::objectValue);
+				object key;
+				for (std::uint32_t i = 0; i < o.size; i++) {
+					if (!in.next(key) || key.type != kind::string) {
+						return false;
+					}
+					if (!decode(in, out[std::string(key.data, key.size)], depth + 1)) {
+						return false;
+					}
+				}
+				return true;
+			}
+			}
+			return false;
+		}
+	}
+
+	/// decodes bytes holding one element into out
+	inline bool decode(const std::string & bytes, Json::Value & out)
+	{
+		reader in(bytes);
+		Json::Value value;
+		if (!detail::decode(in, value, 0) || !in.at_end()) {
+			return false;
+		}
+		out.swap(value);
+		return true;
+	}
+
+	/// appends v to bytes
+	inline void encode(const Json::Value & v, std::string & bytes)
+	{
+		writer(bytes).write(v);
+	}
+
+	/// the array of values, e.g. the arguments of a call
+	template <typename... A>
+	std::string pack(const A &... values)
+	{
+		std::string bytes;
+		writer out(bytes);
+		out.array(sizeof...(A));
+		int expand[] = { 0, (out.write(values), 0)... };
+		(void)expand;
+		return bytes;
+	}
+}
@@ -0,0 +1,191 @@
+#pragma once
+#include <libs/delegate/Delegate.hpp>
+#include <libs/delegate/Epoch.hpp>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+//---------------------------------------------------------------------------------
+/// multicast_delegate class
+/// an event: calling it calls every subscribed delegate in subscription order.
+/// subscribers are kept in an immutable, copy-on-write list, so subscribe and
+/// unsubscribe never block a broadcast in progress and a broadcast is a tight
+/// loop over a contiguous array of (object pointer, stub pointer) pairs.
+/// replaced lists are reclaimed through epoch_retire.
+//---------------------------------------------------------------------------------
+template <typename T> class multicast_delegate;
+
+template<class ...A>
+class multicast_delegate<void (A...)>
+{
+public:
+  using delegate_type = delegate<void (A...)>;
+
+  /// identifies a subscription, 0 is never used
+  using token = ::std::uint64_t;
+
+  multicast_delegate() = default;
+
+  multicast_delegate(multicast_delegate const&) = delete;
+
+  multicast_delegate& operator=(multicast_delegate const&) = delete;
+
+  /// must not race with broadcasts
+  ~multicast_delegate() { delete list_.load(::std::memory_order_relaxed); }
+
+  /// adds a subscriber, lock-free
+  /// @return token to unsubscribe with, 0 if d is empty
+  token subscribe(delegate_type d)
+  {
+    if (!d)
+    {
+      return 0;
+    }
+
+    subscription added{ next_token_.fetch_add(1, ::std::memory_order_relaxed),
+      ::std::make_shared<delegate_type>(::std::move(d)) };
+
+    update([&added](list const& from, list& to)
+    {
+      to.reserve(from.entries.size() + 1);
+      to.entries = from.entries;
+      to.subscriptions = from.subscriptions;
+      to.add(added);
+      return true;
+    });
+
+    return added.id;
+  }
+
+  /// removes a subscriber, lock-free. broadcasts in progress may still call it.
+  /// @return false if the token was not subscribed
+  bool unsubscribe(token const id)
+  {
+    return update([id](list const& from, list& to)
+    {
+      to.reserve(from.entries.size());
+      for (auto const& s : from.subscriptions)
+      {
+        if (s.id != id)
+        {
+          to.add(s);
+        }
+      }
+      return to.entries.size() != from.entries.size();
+    });
+  }
+
+  token operator+=(delegate_type d) { return subscribe(::std::move(d)); }
+
+  bool operator-=(token const id) { return unsubscribe(id); }
+
+  void clear()
+  {
+    epoch_retire(list_.exchange(nullptr, ::std::memory_order_acq_rel));
+  }
+
+  ::std::size_t size() const
+  {
+    epoch_guard guard;
+
+    auto const l = list_.load(::std::memory_order_acquire);
+
+    return l ? l->entries.size() : 0;
+  }
+
+  bool empty() const { return !size(); }
+
+  /// calls every subscriber with the same arguments
+  void operator()(delegate_param_t<A>... args) const
+  {
+    epoch_guard guard;
+
+    auto const l = list_.load(::std::memory_order_acquire);
+
+    if (!l)
+    {
+      return;
+    }
+
+    for (auto const& e : l->entries)
+    {
+      e.stub_ptr(e.object_ptr, args...);
+    }
+  }
+
+private:
+  using stub_ptr_type = typename delegate_type::stub_ptr_type;
+
+  struct entry
+  {
+    void* object_ptr;
+    stub_ptr_type stub_ptr;
+  };
+
+  // subscribers are allocated once and never move, so entries can point
+  // into them. lists share them, the last list to drop one deletes it.
+  struct subscription
+  {
+    token id;
+    ::std::shared_ptr<delegate_type> target;
+  };
+
+  struct list
+  {
+    ::std::vector<entry> entries;
+    ::std::vector<subscription> subscriptions;
+
+    void reserve(::std::size_t const n)
+    {
+      entries.reserve(n);
+      subscriptions.reserve(n);
+    }
+
+    void add(subscription const& s)
+    {
+      entries.push_back({ s.target->object_ptr_, s.target->stub_ptr_ });
+      subscriptions.push_back(s);
+    }
+  };
+
+  ::std::atomic<list*> list_{nullptr};
+  ::std::atomic<token> next_token_{1};
+
+  // copy-on-write: build a new list from the current one and publish it,
+  // retrying if another writer published first
+  template <typename F>
+  bool update(F const& modify)
+  {
+    static list const empty_list;
+
+    epoch_guard guard;
+
+    auto current = list_.load(::std::memory_order_acquire);
+
+    for (;;)
+    {
+      ::std::unique_ptr<list> next(new list);
+
+      if (!modify(current ? *current : empty_list, *next))
+      {
+        return false;
+      }
+
+      if (next->entries.empty())
+      {
+        next.reset();
+      }
+
+      if (list_.compare_exchange_weak(current, next.get(),
+        ::std::memory_order_acq_rel, ::std::memory_order_acquire))
+      {
+        next.release();
+
+        epoch_retire(current);
+
+        return true;
+      }
+    }
+  }
+};
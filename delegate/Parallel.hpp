@@ -0,0 +1,96 @@
+#pragma once
+#include <libs/delegate/Executor.hpp>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+//---------------------------------------------------------------------------------
+/// parallel algorithms over tuples
+/// parallel_for_each is the for_each of Json.hpp with every element transformed
+/// by its own task, and parallel_invoke calls every function of a tuple with the
+/// same arguments, each in its own task. the fan-out is unrolled at compile time:
+/// one task per element but the first, which runs on the calling thread.
+/// both return once every element is done, then rethrow the first exception.
+///
+///		parallel_for_each(pool, endpoints, counter());
+///		auto results = parallel_invoke(pool, endpoints, 2, "warm");
+//---------------------------------------------------------------------------------
+
+/// stands for the result of a function returning void in parallel_invoke's results
+struct void_result {};
+
+namespace parallel_detail {
+
+	template <typename F>
+	auto call(F && f) -> std::enable_if_t<!std::is_void<decltype(f())>::value, decltype(f())>
+	{
+		return f();
+	}
+
+	template <typename F>
+	auto call(F && f) -> std::enable_if_t<std::is_void<decltype(f())>::value, void_result>
+	{
+		f();
+		return {};
+	}
+
+	inline void wait_all() {}
+
+	template <typename Future, typename... Futures>
+	void wait_all(Future & first, Futures &... rest)
+	{
+		first.wait();
+		wait_all(rest...);
+	}
+
+	template <typename Tuple, typename F>
+	void for_each(executor &, Tuple &, F &, std::index_sequence<>) {}
+
+	template <typename Tuple, typename F, std::size_t... I>
+	void for_each(executor & pool, Tuple & t, F & f, std::index_sequence<0, I...>)
+	{
+		auto tasks = std::make_tuple(pool.async([&t,&f] { std::get<I>(t) = f(std::get<I>(t)); })...);
+		auto run_first = [&t,&f] { std::get<0>(t) = f(std::get<0>(t)); };
+		executor_detail::state<void> first;
+		first.run(run_first);
+		wait_all(std::get<I - 1>(tasks)...);
+		first.get();
+		int expand[] = { 0, (std::get<I - 1>(tasks).get(), 0)... };
+		(void)expand;
+	}
+
+	template <typename Tuple, typename... Args>
+	std::tuple<> invoke(executor &, Tuple &, std::index_sequence<>, Args const &...) { return {}; }
+
+	template <typename Tuple, std::size_t... I, typename... Args>
+	auto invoke(executor & pool, Tuple & t, std::index_sequence<0, I...>, Args const &... args)
+	{
+		auto tasks = std::make_tuple(pool.async([&t,&args...] {
+			return call([&] { return std::get<I>(t)(args...); });
+		})...);
+		auto run_first = [&t,&args...] { return call([&] { return std::get<0>(t)(args...); }); };
+		executor_detail::state<decltype(run_first())> first;
+		first.run(run_first);
+		wait_all(std::get<I - 1>(tasks)...);
+		// braced initialization takes the results in order
+		return std::tuple<decltype(run_first()), decltype(std::get<I - 1>(tasks).get())...>{
+			first.get(), std::get<I - 1>(tasks).get()... };
+	}
+}
+
+/// std::get<I>(t) = f(std::get<I>(t)) for every element, in parallel
+template <typename TupleType, typename FunctionType>
+void parallel_for_each(executor & pool, TupleType & t, FunctionType && f)
+{
+	parallel_detail::for_each(pool, t, f,
+			std::make_index_sequence<std::tuple_size<std::remove_const_t<TupleType>>::value>());
+}
+
+/// calls every function of t with args, in parallel
+/// @return tuple of the results, void_result for functions returning void
+template <typename TupleType, typename... Args>
+auto parallel_invoke(executor & pool, TupleType & t, Args const &... args)
+{
+	return parallel_detail::invoke(pool, t,
+			std::make_index_sequence<std::tuple_size<std::remove_const_t<TupleType>>::value>(), args...);
+}
@@ -0,0 +1,360 @@
+#pragma once
+#include <libs/delegate/Delegate.hpp>
+#include <libs/delegate/Json.hpp>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//---------------------------------------------------------------------------------
+/// hardware performance counters
+/// the perf_counters aspect reads the cycles, instructions, cache misses and
+/// branch misses of the calling thread before and after each call of the wrapped
+/// delegate, and adds the differences to the totals of its name in a perf_registry.
+/// counters are opened per thread with perf_event_open(2) on first use, as one
+/// group led by the cycles counter, and read in user space with rdpmc when the
+/// kernel allows it, otherwise with one read(2) of the group. when the kernel
+/// multiplexes the group, the counts of a call are scaled by the time it was
+/// enabled over the time it was running. a call whose counters could not be
+/// read, or were not running, is counted in calls but not in samples. when the
+/// cycles counter cannot be opened, as in most containers, no call is sampled
+/// and available() is false; another counter that cannot be opened reads as 0.
+///
+///		perf_registry counters;
+///		functions.add_function("score", perf_counters(counters, "score")(make_delegate(&score)));
+///		counters.publish(functions);	// "perf_counters" returns the totals as json
+//---------------------------------------------------------------------------------
+namespace perf_detail {
+
+	enum counter { cycles, instructions, cache_misses, branch_misses, counter_count };
+
+	/// raw counts and the time the counters were enabled and running, in ns
+	struct sample
+	{
+		std::uint64_t values[counter_count];
+		std::uint64_t enabled;
+		std::uint64_t running;
+		bool valid;
+	};
+
+	/// the counters of one thread, opened as one group led by the cycles counter
+	/// so that they are scheduled on the PMU together
+	class thread_counters
+	{
+	public:
+		thread_counters()
+		{
+			static const std::uint64_t configs[counter_count] = {
+				PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+				PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+			for (int i = 0; i < counter_count; i++) {
+				perf_event_attr attr;
+				std::memset(&attr, 0, sizeof(attr));
+				attr.size = sizeof(attr);
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = configs[i];
+				attr.exclude_kernel = 1;
+				attr.exclude_hv = 1;
+				attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+				_fds[i] = int(syscall(__NR_perf_event_open, &attr, 0, -1, i == cycles ? -1 : _fds[cycles], PERF_FLAG_FD_CLOEXEC));
+				if (_fds[i] < 0) {
+					if (i == cycles) {
+						// without a leader there is no group
+						return;
+					}
+					continue;
+				}
+				// position in the values of a group read
+				_slots[i] = _members++;
+				auto page = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, _fds[i], 0);
+				_pages[i] = page == MAP_FAILED ? nullptr : static_cast<perf_event_mmap_page *>(page);
+			}
+			_available = true;
+		}
+
+		~thread_counters()
+		{
+			// members before the leader
+			for (int i = counter_count; i-- > 0; ) {
+				if (_pages[i]) {
+					munmap(_pages[i], sysconf(_SC_PAGESIZE));
+				}
+				if (_fds[i] >= 0) {
+					close(_fds[i]);
+				}
+			}
+		}
+
+		thread_counters(const thread_counters &) = delete;
+		thread_counters & operator=(const thread_counters &) = delete;
+
+		bool available() const { return _available; }
+
+		/// valid is false when the counters could not be read
+		sample read() const
+		{
+			sample s{};
+			if (!_available) {
+				return s;
+			}
+			if (read_user(s) || read_group(s)) {
+				s.valid = true;
+			}
+			return s;
+		}
+
+	private:
+		// with rdpmc, every member through the time of the leader
+		bool read_user(sample & s) const
+		{
+#if defined(__x86_64__) || defined(__i386__)
+			for (int i = 0; i < counter_count; i++) {
+				if (_fds[i] < 0) {
+					s.values[i] = 0;
+				} else if (!_pages[i] || !read_user(*_pages[i], s.values[i], i == cycles ? &s : nullptr)) {
+					return false;
+				}
+			}
+			return true;
+#else
+			(void)s;
+			return false;
+#endif
+		}
+
+#if defined(__x86_64__) || defined(__i386__)
+		// seqlock protocol of the perf mmap page, see linux/perf_event.h
+		static bool read_user(perf_event_mmap_page const & page, std::uint64_t & value, sample * times)
+		{
+			for (;;) {
+				auto const sequence = page.lock;
+				std::atomic_signal_fence(std::memory_order_acquire);
+				auto enabled = page.time_enabled;
+				auto running = page.time_running;
+				auto const index = page.index;
+				if (!page.cap_user_rdpmc || !index) {
+					return false;
+				}
+				std::uint64_t cycles = 0, offset = 0;
+				std::uint32_t mult = 0;
+				std::uint16_t shift = 0;
+				bool const user_time = page.cap_user_time;
+				if (user_time) {
+					cycles = __rdtsc();
+					offset = page.time_offset;
+					mult = page.time_mult;
+					shift = page.time_shift;
+				}
+				std::int64_t count = __builtin_ia32_rdpmc(int(index - 1));
+				auto const width = page.pmc_width;
+				count <<= 64 - width;
+				count >>= 64 - width;
+				value = std::uint64_t(page.offset + count);
+				std::atomic_signal_fence(std::memory_order_acquire);
+				if (page.lock != sequence) {
+					continue;
+				}
+				if (times) {
+					// the times in the page are as of the last schedule in
+					if (enabled != running && !user_time) {
+						return false;
+					}
+					if (user_time) {
+						auto const quotient = cycles >> shift;
+						auto const remainder = cycles & ((std::uint64_t(1) << shift) - 1);
+						auto const delta = offset + quotient * mult + ((remainder * mult) >> shift);
+						enabled += delta;
+						running += delta;
+					}
+					times->enabled = enabled;
+					times->running = running;
+				}
+				return true;
+			}
+		}
+#endif
+
+		// one read(2) of the whole group
+		bool read_group(sample & s) const
+		{
+			std::uint64_t data[3 + counter_count];
+			auto const size = ssize_t(sizeof(std::uint64_t) * (3 + _members));
+			if (::read(_fds[cycles], data, size) != size || data[0] != _members) {
+				return false;
+			}
+			s.enabled = data[1];
+			s.running = data[2];
+			for (int i = 0; i < counter_count; i++) {
+				s.values[i] = _slots[i] < 0 ? 0 : data[3 + _slots[i]];
+			}
+			return true;
+		}
+
+		int _fds[counter_count] = {-1, -1, -1, -1};
+		int _slots[counter_count] = {-1, -1, -1, -1};
+		unsigned _members = 0;
+		perf_event_mmap_page * _pages[counter_count] = {};
+		bool _available = false;
+	};
+
+	inline thread_counters & this_thread_counters()
+	{
+		static thread_local thread_counters counters;
+		return counters;
+	}
+
+	struct totals
+	{
+		std::atomic<std::uint64_t> calls{0};
+		std::atomic<std::uint64_t> samples{0};
+		std::atomic<std::uint64_t> counters[counter_count] = {};
+	};
+}
+
+class perf_registry
+{
+public:
+	/// sums for one name
+	struct totals
+	{
+		std::uint64_t calls;
+		std::uint64_t samples;		// calls whose counters were read
+		std::uint64_t cycles;
+		std::uint64_t instructions;
+		std::uint64_t cache_misses;
+		std::uint64_t branch_misses;
+	};
+
+	/// whether the calling thread could open any hardware counter
+	static bool available() { return perf_detail::this_thread_counters().available(); }
+
+	/// totals of a name, created on first use and kept for the lifetime of the registry
+	perf_detail::totals & entry(const std::string & name)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto & e = _entries[name];
+		if (!e) {
+			e.reset(new perf_detail::totals);
+		}
+		return *e;
+	}
+
+	std::map<std::string, totals> snapshot() const
+	{
+		std::map<std::string, totals> out;
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (auto & e : _entries) {
+			auto & t = *e.second;
+			out[e.first] = totals{ t.calls.load(std::memory_order_relaxed),
+				t.samples.load(std::memory_order_relaxed),
+				t.counters[perf_detail::cycles].load(std::memory_order_relaxed),
+				t.counters[perf_detail::instructions].load(std::memory_order_relaxed),
+				t.counters[perf_detail::cache_misses].load(std::memory_order_relaxed),
+				t.counters[perf_detail::branch_misses].load(std::memory_order_relaxed) };
+		}
+		return out;
+	}
+
+	Json::Value to_json() const
+	{
+		Json::Value out;
+		out["available"] = available();
+		out["functions"] = Json::Value(Json::objectValue);
+		for (auto & e : snapshot()) {
+			auto & f = out["functions"][e.first];
+			f["calls"] = Json::UInt64(e.second.calls);
+			f["samples"] = Json::UInt64(e.second.samples);
+			f["cycles"] = Json::UInt64(e.second.cycles);
+			f["instructions"] = Json::UInt64(e.second.instructions);
+			f["cache_misses"] = Json::UInt64(e.second.cache_misses);
+			f["branch_misses"] = Json::UInt64(e.second.branch_misses);
+		}
+		return out;
+	}
+
+	/// makes the totals callable by name through functions
+	void publish(JsonFunctions & functions, const std::string & name = "perf_counters") const
+	{
+		functions.add_json_function(name, [this](const Json::Value &) { return to_json(); });
+	}
+
+private:
+	mutable std::mutex _mutex;
+	std::map<std::string, std::unique_ptr<perf_detail::totals>> _entries;
+};
+
+//---------------------------------------------------------------------------------
+/// perf_counters aspect
+/// adds the hardware counters of every call of the wrapped delegate to name.
+//---------------------------------------------------------------------------------
+class perf_counters
+{
+public:
+	perf_counters(perf_registry & registry, const std::string & name) :_totals(&registry.entry(name)) {}
+
+	template<typename R, typename... Args>
+	delegate<R(Args...)> operator () (delegate<R(Args...)> f) const
+	{
+		auto totals = _totals;
+		return [totals,f](delegate_param_t<Args>... args) -> R
+		{
+			measure m(*totals);
+			return f(std::forward<delegate_param_t<Args>>(args)...);
+		};
+	}
+
+private:
+	class measure
+	{
+	public:
+		explicit measure(perf_detail::totals & totals)
+		:_totals(totals)
+		,_counters(perf_detail::this_thread_counters())
+		,_start(_counters.read())
+		{}
+
+		~measure()
+		{
+			auto const end = _counters.read();
+			_totals.calls.fetch_add(1, std::memory_order_relaxed);
+			if (!_start.valid || !end.valid || end.running <= _start.running || end.enabled < _start.enabled) {
+				return;
+			}
+			std::uint64_t delta[perf_detail::counter_count];
+			for (int i = 0; i < perf_detail::counter_count; i++) {
+				if (end.values[i] < _start.values[i]) {
+					return;
+				}
+				delta[i] = end.values[i] - _start.values[i];
+			}
+			auto const enabled = end.enabled - _start.enabled;
+			auto const running = end.running - _start.running;
+			_totals.samples.fetch_add(1, std::memory_order_relaxed);
+			for (int i = 0; i < perf_detail::counter_count; i++) {
+				auto value = delta[i];
+				if (running < enabled) {
+					value = std::uint64_t(double(value) * enabled / running);
+				}
+				_totals.counters[i].fetch_add(value, std::memory_order_relaxed);
+			}
+		}
+
+	private:
+		perf_detail::totals & _totals;
+		perf_detail::thread_counters & _counters;
+		perf_detail::sample _start;
+	};
+
+	perf_detail::totals * _totals;
+};
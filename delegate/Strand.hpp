@@ -0,0 +1,384 @@
+#pragma once
+#include <libs/delegate/Delegate.hpp>
+#include <libs/delegate/Executor.hpp>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+//---------------------------------------------------------------------------------
+/// strand class
+/// serializes the calls to an object that is not thread-safe, without a mutex.
+/// every call becomes a message on a lock-free multi-producer single-consumer
+/// queue of the strand; when the queue turns non-empty the strand posts itself
+/// to an executor, and the worker that runs it drains the queue in FIFO order.
+/// calls are packed with their arguments into records taken from a preallocated
+/// pool, which the futures give back, so posting a message does not allocate
+/// once the call and its result fit in a record.
+///
+///		service s;
+///		strand<service> serialized(pool, s);
+///		auto lookup = serialized.wrap(&service::lookup);
+///		auto found = lookup("key").get();
+//---------------------------------------------------------------------------------
+namespace strand_detail {
+
+	/// storage of a T, in place when it fits, otherwise on the heap
+	template <typename T, typename Storage,
+		bool = sizeof(T) <= sizeof(Storage) && alignof(T) <= alignof(Storage)>
+	struct slot
+	{
+		template <typename... A>
+		static void construct(Storage & s, A &&... a) { new (&s) T(std::forward<A>(a)...); }
+		static T & get(Storage & s) { return *reinterpret_cast<T *>(&s); }
+		static void destroy(Storage & s) { get(s).~T(); }
+	};
+
+	template <typename T, typename Storage>
+	struct slot<T, Storage, false>
+	{
+		template <typename... A>
+		static void construct(Storage & s, A &&... a) { new (&s) T *(new T(std::forward<A>(a)...)); }
+		static T & get(Storage & s) { return **reinterpret_cast<T **>(&s); }
+		static void destroy(Storage & s) { delete &get(s); }
+	};
+
+	/// one message: a bound call, then its result
+	class record : public executor_detail::state_base
+	{
+	public:
+		using call_storage = std::aligned_storage<64, alignof(std::max_align_t)>::type;
+		using result_storage = std::aligned_storage<32, alignof(std::max_align_t)>::type;
+
+		/// makes f(object) the call of the record
+		template <typename C, typename R, typename F>
+		void bind(F && f)
+		{
+			using call_type = std::decay_t<F>;
+			slot<call_type, call_storage>::construct(_call, std::forward<F>(f));
+			_run = &invoke<C, R, call_type>;
+		}
+
+		void run(void * object) { _run(*this, object); }
+
+		template <typename R>
+		std::enable_if_t<!std::is_void<R>::value, R> take()
+		{
+			rethrow();
+			R value(std::move(slot<R, result_storage>::get(_result)));
+			_destroy(*this);
+			_destroy = nullptr;
+			return value;
+		}
+
+		template <typename R>
+		std::enable_if_t<std::is_void<R>::value> take() { rethrow(); }
+
+		/// the strand and the future each hold a reference
+		void acquired() { _references.store(2, std::memory_order_relaxed); }
+
+		void release()
+		{
+			if (_references.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+				return;
+			}
+			if (_destroy) {
+				_destroy(*this);
+				_destroy = nullptr;
+			}
+			reset();
+			if (home) {
+				home->push(this);
+			} else {
+				delete this;
+			}
+		}
+
+		std::atomic<record *> next{nullptr};
+		/// free list of the pool the record belongs to, nullptr for a record from the heap
+		executor_detail::bounded_queue<record> * home = nullptr;
+
+	private:
+		template <typename C, typename R, typename F>
+		static void invoke(record & r, void * object)
+		{
+			auto & call = slot<F, call_storage>::get(r._call);
+			try {
+				r.store<R>(call, *static_cast<C *>(object));
+			} catch (...) {
+				r._error = std::current_exception();
+			}
+			slot<F, call_storage>::destroy(r._call);
+			r.complete();
+		}
+
+		template <typename R, typename F, typename C>
+		std::enable_if_t<!std::is_void<R>::value> store(F & call, C & object)
+		{
+			slot<R, result_storage>::construct(_result, call(object));
+			_destroy = [](record & r) { slot<R, result_storage>::destroy(r._result); };
+		}
+
+		template <typename R, typename F, typename C>
+		std::enable_if_t<std::is_void<R>::value> store(F & call, C & object) { call(object); }
+
+		void (*_run)(record &, void *) = nullptr;
+		// destroys a result that was not taken
+		void (*_destroy)(record &) = nullptr;
+		std::atomic<int> _references{0};
+		call_storage _call;
+		result_storage _result;
+	};
+
+	/// call of a member function with arguments stored by value
+	template <typename M, typename... P>
+	struct member_call
+	{
+		template <typename... A>
+		explicit member_call(M method, A &&... args) :method(method), args(std::forward<A>(args)...) {}
+
+		template <typename C>
+		decltype(auto) operator()(C & object) { return call(object, std::index_sequence_for<P...>()); }
+
+		template <typename C, std::size_t... I>
+		decltype(auto) call(C & object, std::index_sequence<I...>)
+		{
+			return (object.*method)(std::forward<P>(std::get<I>(args))...);
+		}
+
+		M method;
+		std::tuple<std::decay_t<P>...> args;
+	};
+}
+
+/// result of a call through a strand. get() may be called once.
+template <typename R>
+class strand_future
+{
+public:
+	strand_future() = default;
+
+	strand_future(strand_future && other) noexcept
+	:_record(other._record)
+	,_pool(other._pool)
+	{
+		other._record = nullptr;
+	}
+
+	strand_future & operator=(strand_future && other) noexcept
+	{
+		std::swap(_record, other._record);
+		std::swap(_pool, other._pool);
+		return *this;
+	}
+
+	~strand_future()
+	{
+		if (_record) {
+			_record->release();
+		}
+	}
+
+	bool valid() const { return _record != nullptr; }
+
+	/// true once the call finished, without waiting
+	bool ready() const { return _record->ready(); }
+
+	/// waits for the call. a worker of the pool runs other tasks while it waits.
+	void wait()
+	{
+		if (!_record->ready()) {
+			_pool->wait(*_record);
+		}
+	}
+
+	R get()
+	{
+		wait();
+		std::unique_ptr<strand_detail::record, releaser> r(_record);
+		_record = nullptr;
+		return r->template take<R>();
+	}
+
+private:
+	template <typename C> friend class strand;
+
+	struct releaser
+	{
+		void operator()(strand_detail::record * r) const { r->release(); }
+	};
+
+	strand_future(strand_detail::record * r, executor * pool) :_record(r), _pool(pool) {}
+
+	strand_detail::record * _record = nullptr;
+	executor * _pool = nullptr;
+};
+
+template <typename C>
+class strand
+{
+public:
+	/// records: number of preallocated messages. more messages in flight come from the heap.
+	strand(executor & pool, C & object, std::size_t records = 256)
+	:_pool(pool)
+	,_object(object)
+	,_records(new strand_detail::record[records])
+	,_free(round_up(records))
+	,_head(&_stub)
+	,_tail(&_stub)
+	,_drain([this] { drain(); })
+	{
+		for (std::size_t i = 0; i < records; i++) {
+			_records[i].home = &_free;
+			_free.push(&_records[i]);
+		}
+	}
+
+	strand(const strand &) = delete;
+	strand & operator=(const strand &) = delete;
+
+	/// waits for every queued call. futures must not outlive the strand.
+	~strand()
+	{
+		while (_pending.load(std::memory_order_acquire)) {
+			if (!_pool.run_one()) {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	/// calls f(object) on the strand
+	template <typename F>
+	strand_future<std::result_of_t<F &(C &)>> post(F && f)
+	{
+		using R = std::result_of_t<F &(C &)>;
+		auto r = acquire();
+		r->template bind<C, R>(std::forward<F>(f));
+		enqueue(r);
+		return strand_future<R>(r, &_pool);
+	}
+
+	/// calls (object.*m)(args...) on the strand, with copies of args
+	template <typename R, typename... P, typename... A>
+	strand_future<R> call(R (C::*m)(P...), A &&... args)
+	{
+		return post(strand_detail::member_call<R (C::*)(P...), P...>(m, std::forward<A>(args)...));
+	}
+
+	template <typename R, typename... P, typename... A>
+	strand_future<R> call(R (C::*m)(P...) const, A &&... args)
+	{
+		return post(strand_detail::member_call<R (C::*)(P...) const, P...>(m, std::forward<A>(args)...));
+	}
+
+	/// delegate making asynchronous calls of m on the strand
+	template <typename R, typename... P>
+	delegate<strand_future<R>(P...)> wrap(R (C::*m)(P...))
+	{
+		return [this, m](delegate_param_t<P>... args) { return call(m, std::forward<delegate_param_t<P>>(args)...); };
+	}
+
+	template <typename R, typename... P>
+	delegate<strand_future<R>(P...)> wrap(R (C::*m)(P...) const)
+	{
+		return [this, m](delegate_param_t<P>... args) { return call(m, std::forward<delegate_param_t<P>>(args)...); };
+	}
+
+private:
+	// calls run by one task before it gives the other tasks of the pool a turn
+	static const int batch = 64;
+
+	static std::size_t round_up(std::size_t n)
+	{
+		std::size_t capacity = 2;
+		while (capacity < n) {
+			capacity *= 2;
+		}
+		return capacity;
+	}
+
+	strand_detail::record * acquire()
+	{
+		auto r = _free.pop();
+		if (!r) {
+			r = new strand_detail::record;
+		}
+		r->acquired();
+		return r;
+	}
+
+	// intrusive MPSC queue (Vyukov): producers swap the head, the drain owns the tail
+	void enqueue(strand_detail::record * r)
+	{
+		r->next.store(nullptr, std::memory_order_relaxed);
+		auto previous = _head.exchange(r, std::memory_order_acq_rel);
+		previous->next.store(r, std::memory_order_release);
+		if (_pending.fetch_add(1, std::memory_order_acq_rel) == 0) {
+			_pool.post_unowned(_drain);
+		}
+	}
+
+	// nullptr when empty or while a producer is linking its message
+	strand_detail::record * pop()
+	{
+		auto tail = _tail;
+		auto next = tail->next.load(std::memory_order_acquire);
+		if (tail == &_stub) {
+			if (!next) {
+				return nullptr;
+			}
+			_tail = tail = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+		if (next) {
+			_tail = next;
+			return tail;
+		}
+		if (tail != _head.load(std::memory_order_acquire)) {
+			return nullptr;
+		}
+		// tail is the last message: put the stub behind it to take it
+		_stub.next.store(nullptr, std::memory_order_relaxed);
+		auto previous = _head.exchange(&_stub, std::memory_order_acq_rel);
+		previous->next.store(&_stub, std::memory_order_release);
+		next = tail->next.load(std::memory_order_acquire);
+		if (next) {
+			_tail = next;
+			return tail;
+		}
+		return nullptr;
+	}
+
+	void drain()
+	{
+		for (int n = 0; n < batch; n++) {
+			strand_detail::record * r;
+			// pending counts messages already enqueued: one is on its way
+			while (!(r = pop())) {
+				std::this_thread::yield();
+			}
+			r->run(&_object);
+			r->release();
+			if (_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				return;
+			}
+		}
+		_pool.post_unowned(_drain);
+	}
+
+	executor & _pool;
+	C & _object;
+	std::unique_ptr<strand_detail::record[]> _records;
+	executor_detail::bounded_queue<strand_detail::record> _free;
+	strand_detail::record _stub;
+	std::atomic<strand_detail::record *> _head;
+	// producers and the drain update different cache lines
+	char _padding[64];
+	strand_detail::record * _tail;
+	std::atomic<std::size_t> _pending{0};
+	executor::task _drain;
+};
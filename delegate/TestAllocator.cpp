@@ -0,0 +1,53 @@
+// replaces the global allocation functions for testDelegate and counts the
+// calls to operator new, so tests can check for allocations. it lives in its
+// own translation unit so the compiler does not see the malloc behind new
+// next to the free behind delete.
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+std::atomic<std::size_t> allocation_count{0};
+
+namespace {
+
+	void * allocate(std::size_t size)
+	{
+		allocation_count++;
+		if (void * p = std::malloc(size ? size : 1)) {
+			return p;
+		}
+		throw std::bad_alloc();
+	}
+
+#if defined(__cpp_aligned_new)
+	void * allocate(std::size_t size, std::align_val_t alignment)
+	{
+		allocation_count++;
+		auto const a = static_cast<std::size_t>(alignment) < sizeof(void *) ? sizeof(void *) : static_cast<std::size_t>(alignment);
+		void * p = nullptr;
+		if (posix_memalign(&p, a, size ? size : 1) != 0) {
+			throw std::bad_alloc();
+		}
+		return p;
+	}
+#endif
+}
+
+void * operator new(std::size_t size) { return allocate(size); }
+void * operator new[](std::size_t size) { return allocate(size); }
+
+void operator delete(void * p) noexcept { std::free(p); }
+void operator delete[](void * p) noexcept { std::free(p); }
+void operator delete(void * p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void * p, std::size_t) noexcept { std::free(p); }
+
+#if defined(__cpp_aligned_new)
+void * operator new(std::size_t size, std::align_val_t alignment) { return allocate(size, alignment); }
+void * operator new[](std::size_t size, std::align_val_t alignment) { return allocate(size, alignment); }
+
+void operator delete(void * p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void * p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void * p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void * p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+#endif
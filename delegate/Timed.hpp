@@ -0,0 +1,334 @@
+#pragma once
+#include <libs/delegate/Delegate.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//---------------------------------------------------------------------------------
+/// latency_histogram class
+/// log-linear (HDR style) histogram of nanosecond latencies.
+/// each power of two is split into 16 linear sub-buckets, so a recorded value
+/// is reported within about 6% of its real value, from 1ns to hundreds of years.
+/// every thread records into its own shard: recording is a plain increment of
+/// counters only that thread writes, with no lock and no atomic read-modify-write.
+/// a shard passes to a later thread once its thread exits.
+/// snapshot() merges the shards and may run concurrently with recording.
+//---------------------------------------------------------------------------------
+
+/// merged view of a latency_histogram
+struct histogram_snapshot
+{
+	std::uint64_t count{0};
+	std::uint64_t min{0};
+	std::uint64_t max{0};
+	double mean{0};
+	std::uint64_t p50{0}, p90{0}, p99{0}, p999{0};
+};
+
+namespace timed_detail {
+
+	// cycle counter, converted to nanoseconds with a factor measured once
+	inline std::uint64_t ticks()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	inline double measure_ns_per_tick()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		auto const start = std::chrono::steady_clock::now();
+		auto const start_ticks = ticks();
+		while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(5)) {}
+		auto const ns = std::chrono::duration<double,std::nano>(std::chrono::steady_clock::now() - start).count();
+		return ns / double(ticks() - start_ticks);
+#else
+		return 1.0;
+#endif
+	}
+
+	inline double ns_per_tick()
+	{
+		static const double factor = measure_ns_per_tick();
+		return factor;
+	}
+
+	// indices of the threads alive, the lowest free one goes to the next thread.
+	// allocated once and never destroyed, so threads may exit after static destructors ran
+	struct thread_indices
+	{
+		std::mutex mutex;
+		std::vector<std::size_t> free;
+		std::size_t next = 0;
+	};
+
+	inline thread_indices & indices()
+	{
+		static thread_indices * const i = new thread_indices;
+		return *i;
+	}
+
+	inline std::size_t acquire_index()
+	{
+		auto & i = indices();
+		std::lock_guard<std::mutex> lock(i.mutex);
+		if (i.free.empty()) {
+			return i.next++;
+		}
+		auto const lowest = std::min_element(i.free.begin(), i.free.end());
+		auto const index = *lowest;
+		i.free.erase(lowest);
+		return index;
+	}
+
+	inline void release_index(std::size_t index)
+	{
+		auto & i = indices();
+		std::lock_guard<std::mutex> lock(i.mutex);
+		i.free.push_back(index);
+	}
+
+	// gives the index of its thread back when the thread exits
+	struct index_owner
+	{
+		explicit index_owner(std::size_t i) :index(i) {}
+		~index_owner() { release_index(index); }
+		const std::size_t index;
+	};
+
+	// small per-thread index used to pick a shard. indices are reused, so threads
+	// that come and go keep to the first shards.
+	inline std::size_t thread_index()
+	{
+		// constant initialized, so reading it needs no thread_local init guard
+		static thread_local std::size_t index = std::size_t(-1);
+		if (index == std::size_t(-1)) {
+			static thread_local index_owner owner(acquire_index());
+			index = owner.index;
+		}
+		return index;
+	}
+}
+
+class latency_histogram
+{
+public:
+	static constexpr unsigned sub_bucket_bits = 4;
+	static constexpr std::size_t sub_buckets = std::size_t(1) << sub_bucket_bits;
+	static constexpr std::size_t bucket_count = (64 - sub_bucket_bits + 1) * sub_buckets;
+
+	/// threads beyond this many share one shard, updated atomically
+	static constexpr std::size_t max_shards = 128;
+
+	latency_histogram()
+	{
+		// calibrate the clock here rather than on the first timed call
+		timed_detail::ns_per_tick();
+	}
+
+	latency_histogram(const latency_histogram &) = delete;
+	latency_histogram & operator=(const latency_histogram &) = delete;
+
+	~latency_histogram()
+	{
+		for (auto & s : _shards) {
+			delete s.load(std::memory_order_relaxed);
+		}
+	}
+
+	/// record one latency in nanoseconds
+	void record(std::uint64_t ns)
+	{
+		auto const index = timed_detail::thread_index();
+		if (index < max_shards - 1) {
+			this_shard(index).record(ns);
+		} else {
+			this_shard(max_shards - 1).record_shared(ns);
+		}
+	}
+
+	/// measures the lifetime of a scope and records it
+	class timer
+	{
+	public:
+		explicit timer(latency_histogram & histogram)
+		:_histogram(histogram)
+		,_start(timed_detail::ticks())
+		{}
+
+		~timer()
+		{
+			auto const elapsed = timed_detail::ticks() - _start;
+			_histogram.record(std::uint64_t(elapsed * timed_detail::ns_per_tick()));
+		}
+
+		timer(const timer &) = delete;
+		timer & operator=(const timer &) = delete;
+
+	private:
+		latency_histogram & _histogram;
+		std::uint64_t _start;
+	};
+
+	/// merge every shard
+	histogram_snapshot snapshot() const
+	{
+		std::vector<std::uint64_t> counts(bucket_count, 0);
+		histogram_snapshot out;
+		out.min = std::numeric_limits<std::uint64_t>::max();
+		double sum = 0;
+		for (auto & slot : _shards) {
+			auto s = slot.load(std::memory_order_acquire);
+			if (!s) {
+				continue;
+			}
+			for (std::size_t i = 0; i < bucket_count; i++) {
+				counts[i] += s->counts[i].load(std::memory_order_relaxed);
+			}
+			sum += double(s->sum.load(std::memory_order_relaxed));
+			out.min = std::min(out.min, s->min.load(std::memory_order_relaxed));
+			out.max = std::max(out.max, s->max.load(std::memory_order_relaxed));
+		}
+		for (auto c : counts) {
+			out.count += c;
+		}
+		if (!out.count) {
+			out.min = 0;
+			return out;
+		}
+		out.mean = sum / double(out.count);
+		out.p50 = percentile(counts, out.count, 0.5);
+		out.p90 = percentile(counts, out.count, 0.9);
+		out.p99 = percentile(counts, out.count, 0.99);
+		out.p999 = percentile(counts, out.count, 0.999);
+		return out;
+	}
+
+	static std::size_t bucket_index(std::uint64_t value)
+	{
+		if (value < sub_buckets) {
+			return std::size_t(value);
+		}
+		unsigned const exponent = 63 - __builtin_clzll(value);
+		auto const sub = (value >> (exponent - sub_bucket_bits)) & (sub_buckets - 1);
+		return (exponent - sub_bucket_bits + 1) * sub_buckets + std::size_t(sub);
+	}
+
+	/// middle of the range of values counted in a bucket
+	static std::uint64_t bucket_value(std::size_t index)
+	{
+		if (index < sub_buckets) {
+			return index;
+		}
+		unsigned const shift = unsigned(index / sub_buckets) - 1;
+		auto const lowest = (sub_buckets + index % sub_buckets) << shift;
+		return lowest + ((std::uint64_t(1) << shift) >> 1);
+	}
+
+private:
+	struct shard
+	{
+		std::atomic<std::uint64_t> counts[bucket_count];
+		std::atomic<std::uint64_t> sum{0};
+		std::atomic<std::uint64_t> min{std::numeric_limits<std::uint64_t>::max()};
+		std::atomic<std::uint64_t> max{0};
+
+		shard()
+		{
+			for (auto & c : counts) {
+				c.store(0, std::memory_order_relaxed);
+			}
+		}
+
+		// only called by the thread owning the shard
+		void record(std::uint64_t ns)
+		{
+			auto & c = counts[bucket_index(ns)];
+			c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			sum.store(sum.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+			if (ns < min.load(std::memory_order_relaxed)) {
+				min.store(ns, std::memory_order_relaxed);
+			}
+			if (ns > max.load(std::memory_order_relaxed)) {
+				max.store(ns, std::memory_order_relaxed);
+			}
+		}
+
+		// called by any number of threads
+		void record_shared(std::uint64_t ns)
+		{
+			counts[bucket_index(ns)].fetch_add(1, std::memory_order_relaxed);
+			sum.fetch_add(ns, std::memory_order_relaxed);
+			auto low = min.load(std::memory_order_relaxed);
+			while (ns < low && !min.compare_exchange_weak(low, ns, std::memory_order_relaxed)) {}
+			auto high = max.load(std::memory_order_relaxed);
+			while (ns > high && !max.compare_exchange_weak(high, ns, std::memory_order_relaxed)) {}
+		}
+	};
+
+	shard & this_shard(std::size_t index)
+	{
+		auto s = _shards[index].load(std::memory_order_acquire);
+		if (!s) {
+			std::unique_ptr<shard> created(new shard);
+			if (_shards[index].compare_exchange_strong(s, created.get(), std::memory_order_acq_rel)) {
+				s = created.release();
+			}
+		}
+		return *s;
+	}
+
+	static std::uint64_t percentile(const std::vector<std::uint64_t> & counts, std::uint64_t total, double q)
+	{
+		auto const rank = std::uint64_t(q * double(total - 1)) + 1;
+		std::uint64_t seen = 0;
+		for (std::size_t i = 0; i < counts.size(); i++) {
+			seen += counts[i];
+			if (seen >= rank) {
+				return bucket_value(i);
+			}
+		}
+		return bucket_value(counts.size() - 1);
+	}
+
+	std::atomic<shard *> _shards[max_shards]{};
+};
+
+//---------------------------------------------------------------------------------
+/// timed aspect
+/// records the latency of every call of the wrapped delegate into a histogram.
+///
+///		latency_histogram latencies;
+///		auto f = timed(latencies)(make_delegate(&service, &service::handle));
+//---------------------------------------------------------------------------------
+class timed
+{
+public:
+	explicit timed(latency_histogram & histogram) :_histogram(&histogram) {}
+
+	template<typename R, typename... Args>
+	delegate<R(Args...)> operator () (delegate<R(Args...)> f) const
+	{
+		auto histogram = _histogram;
+		return [histogram,f](delegate_param_t<Args>... args)
+		{
+			latency_histogram::timer t(*histogram);
+			return f(std::forward<delegate_param_t<Args>>(args)...);
+		};
+	}
+
+private:
+	latency_histogram * _histogram;
+};
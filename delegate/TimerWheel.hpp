@@ -0,0 +1,348 @@
+#pragma once
+#include <libs/delegate/Delegate.hpp>
+#include <libs/delegate/Executor.hpp>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//---------------------------------------------------------------------------------
+/// timer_wheel class
+/// hashed hierarchical timing wheel (Varghese, Lauck) of delegate<void()> callbacks.
+/// four levels of 256 slots cover 2^32 ticks; a timer goes to the lowest level
+/// whose span holds its delay and moves down a level each time the wheel turns
+/// past its slot, so scheduling and cancelling are O(1) and a tick costs O(1)
+/// amortized. one timer thread advances the wheel and posts expired callbacks to
+/// an executor with post_queued(), so callbacks never run on the timer thread,
+/// even when the executor's injection queue is full, and slow callbacks do not
+/// delay other timers.
+/// timers live in chunks of preallocated nodes reused through a free list: memory
+/// follows the largest number of outstanding timers, not the number scheduled.
+///
+///		timer_wheel timers(pool);
+///		auto retry = timers.after(std::chrono::milliseconds(200), [&] { resend(); });
+///		timers.every(std::chrono::seconds(1), [&] { sink.flush(); });
+///		timers.cancel(retry);
+//---------------------------------------------------------------------------------
+
+/// handle of a scheduled timer. stays invalid once the timer fired or was cancelled.
+struct timer_id
+{
+	std::uint32_t index;
+	std::uint32_t generation;
+};
+
+namespace timer_detail {
+
+	const unsigned bits = 8;
+	const unsigned slots = 1u << bits;
+	const unsigned levels = 4;
+	const std::uint32_t none = ~std::uint32_t(0);
+
+	struct node
+	{
+		executor::task callback;
+		std::uint64_t expiry = 0;
+		/// ticks between two runs, 0 for a timer that runs once
+		std::uint64_t period = 0;
+		std::uint32_t previous = none;
+		std::uint32_t next = none;
+		std::uint32_t generation = 0;
+		/// level * slots + slot while scheduled, none while free
+		std::uint32_t list = none;
+	};
+}
+
+class timer_wheel
+{
+public:
+	using task = executor::task;
+
+	/// threaded: a thread of the wheel advances it. manual: the owner calls advance().
+	enum mode { threaded, manual };
+
+	explicit timer_wheel(executor & pool, std::chrono::nanoseconds tick = std::chrono::milliseconds(1), mode m = threaded)
+	:_pool(pool)
+	,_tick(std::chrono::duration_cast<clock::duration>(tick))
+	,_start(clock::now())
+	,_threaded(m == threaded)
+	{
+		for (auto & head : _heads) {
+			head = timer_detail::none;
+		}
+		if (_tick <= clock::duration::zero()) {
+			_tick = clock::duration(1);
+		}
+		if (_threaded) {
+			_thread = std::thread([this] { run(); });
+		}
+	}
+
+	timer_wheel(const timer_wheel &) = delete;
+	timer_wheel & operator=(const timer_wheel &) = delete;
+
+	/// drops the timers that did not fire
+	~timer_wheel()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopping = true;
+		}
+		_wake.notify_one();
+		if (_thread.joinable()) {
+			_thread.join();
+		}
+	}
+
+	/// runs f once, delay after now, rounded up to a whole tick
+	timer_id after(std::chrono::nanoseconds delay, task f)
+	{
+		return schedule(delay, 0, std::move(f));
+	}
+
+	/// runs f every period, the first time one period after now
+	timer_id every(std::chrono::nanoseconds period, task f)
+	{
+		return schedule(period, ticks(period), std::move(f));
+	}
+
+	/// @return false when the timer already fired or was cancelled
+	bool cancel(timer_id id)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (id.index >= _chunks.size() * chunk_size) {
+			return false;
+		}
+		auto & n = node(id.index);
+		if (n.generation != id.generation || n.list == timer_detail::none) {
+			return false;
+		}
+		unlink(id.index);
+		release(id.index);
+		return true;
+	}
+
+	/// number of outstanding timers
+	std::size_t size() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _count;
+	}
+
+	/// ticks the wheel went through
+	std::uint64_t now() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _now;
+	}
+
+	/// turns a manual wheel by ticks. one thread at a time.
+	void advance(std::uint64_t ticks = 1)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		turn_to(_now + ticks, lock);
+	}
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	static const std::uint32_t chunk_size = 4096;
+
+	// whole ticks in delay, rounded up, at least one
+	std::uint64_t ticks(std::chrono::nanoseconds delay) const
+	{
+		auto const d = std::chrono::duration_cast<clock::duration>(delay);
+		auto const t = (d + _tick - clock::duration(1)) / _tick;
+		return t > 0 ? std::uint64_t(t) : 1;
+	}
+
+	std::uint64_t elapsed() const { return std::uint64_t((clock::now() - _start) / _tick); }
+
+	timer_detail::node & node(std::uint32_t index)
+	{
+		return _chunks[index / chunk_size][index % chunk_size];
+	}
+
+	timer_id schedule(std::chrono::nanoseconds delay, std::uint64_t period, task f)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto expiry = _now + ticks(delay);
+		if (_threaded) {
+			// an empty wheel stops turning: catch up with the clock
+			if (!_count) {
+				_now = std::max(_now, elapsed());
+			}
+			// the wheel is up to a tick behind the clock: count from the clock
+			expiry = std::max(_now + 1, ticks(clock::now() - _start + delay));
+		}
+		auto const index = acquire();
+		auto & n = node(index);
+		n.callback = std::move(f);
+		n.expiry = expiry;
+		n.period = period;
+		insert(index);
+		if (_count++ == 0) {
+			_wake.notify_one();
+		}
+		return timer_id{index, n.generation};
+	}
+
+	std::uint32_t acquire()
+	{
+		if (_free == timer_detail::none) {
+			auto const first = std::uint32_t(_chunks.size() * chunk_size);
+			_chunks.emplace_back(new timer_detail::node[chunk_size]);
+			for (std::uint32_t i = chunk_size; i-- > 0; ) {
+				node(first + i).next = _free;
+				_free = first + i;
+			}
+		}
+		auto const index = _free;
+		_free = node(index).next;
+		return index;
+	}
+
+	void release(std::uint32_t index)
+	{
+		auto & n = node(index);
+		n.callback.reset();
+		n.generation++;
+		n.list = timer_detail::none;
+		n.next = _free;
+		_free = index;
+		_count--;
+	}
+
+	void insert(std::uint32_t index)
+	{
+		auto & n = node(index);
+		auto const delay = n.expiry - _now;
+		auto slot_tick = n.expiry;
+		unsigned level = 0;
+		while (level + 1 < timer_detail::levels && delay >> (timer_detail::bits * (level + 1))) {
+			level++;
+		}
+		if (delay >> (timer_detail::bits * timer_detail::levels)) {
+			// beyond the wheel: park in the last slot of the top level to be sorted again
+			slot_tick = _now + (std::uint64_t(timer_detail::slots - 1) << (timer_detail::bits * level));
+		}
+		auto const list = level * timer_detail::slots
+			+ unsigned(slot_tick >> (timer_detail::bits * level)) % timer_detail::slots;
+		n.list = list;
+		n.previous = timer_detail::none;
+		n.next = _heads[list];
+		if (n.next != timer_detail::none) {
+			node(n.next).previous = index;
+		}
+		_heads[list] = index;
+	}
+
+	void unlink(std::uint32_t index)
+	{
+		auto & n = node(index);
+		if (n.previous != timer_detail::none) {
+			node(n.previous).next = n.next;
+		} else {
+			_heads[n.list] = n.next;
+		}
+		if (n.next != timer_detail::none) {
+			node(n.next).previous = n.previous;
+		}
+	}
+
+	// moves the timers of the current slot of level to the levels below
+	void cascade(unsigned level)
+	{
+		auto const list = level * timer_detail::slots
+			+ unsigned(_now >> (timer_detail::bits * level)) % timer_detail::slots;
+		auto index = _heads[list];
+		_heads[list] = timer_detail::none;
+		while (index != timer_detail::none) {
+			auto const next = node(index).next;
+			insert(index);
+			index = next;
+		}
+	}
+
+	void turn()
+	{
+		_now++;
+		for (unsigned level = 1; level < timer_detail::levels; level++) {
+			if (_now & ((std::uint64_t(1) << (timer_detail::bits * level)) - 1)) {
+				break;
+			}
+			cascade(level);
+		}
+		auto const list = unsigned(_now % timer_detail::slots);
+		auto index = _heads[list];
+		_heads[list] = timer_detail::none;
+		while (index != timer_detail::none) {
+			auto & n = node(index);
+			auto const next = n.next;
+			if (n.period) {
+				_expired.push_back(n.callback);
+				n.expiry += n.period;
+				insert(index);
+			} else {
+				_expired.push_back(std::move(n.callback));
+				release(index);
+			}
+			index = next;
+		}
+	}
+
+	// turns the wheel up to target, posting expired callbacks without the lock
+	void turn_to(std::uint64_t target, std::unique_lock<std::mutex> & lock)
+	{
+		while (_now < target) {
+			if (!_count) {
+				_now = target;
+				break;
+			}
+			turn();
+			if (!_expired.empty()) {
+				lock.unlock();
+				for (auto & callback : _expired) {
+					_pool.post_queued(std::move(callback));
+				}
+				_expired.clear();
+				lock.lock();
+			}
+		}
+	}
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		while (!_stopping) {
+			auto const target = elapsed();
+			if (target > _now) {
+				turn_to(target, lock);
+			} else if (!_count) {
+				_wake.wait(lock, [this] { return _stopping || _count; });
+			} else {
+				_wake.wait_until(lock, _start + _tick * clock::rep(_now + 1));
+			}
+		}
+	}
+
+	executor & _pool;
+	clock::duration _tick;
+	const clock::time_point _start;
+	const bool _threaded;
+	mutable std::mutex _mutex;
+	std::condition_variable _wake;
+	bool _stopping = false;
+	std::uint64_t _now = 0;
+	std::size_t _count = 0;
+	std::uint32_t _heads[timer_detail::levels * timer_detail::slots];
+	std::vector<std::unique_ptr<timer_detail::node[]>> _chunks;
+	std::uint32_t _free = timer_detail::none;
+	// callbacks expired by the current turn, kept to reuse the vector
+	std::vector<task> _expired;
+	std::thread _thread;
+};
@@ -0,0 +1,351 @@
+#pragma once
+#include <libs/delegate/Delegate.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+//---------------------------------------------------------------------------------
+/// tracer class
+/// records spans of nested calls and writes them as Chrome trace-event JSON,
+/// which chrome://tracing and Perfetto load as a timeline per thread.
+/// each thread appends completed spans to its own chunked buffer: a chunk is
+/// filled by its thread only and publishes its event count with a release store,
+/// so write() can run while threads are tracing. write() consumes the spans it
+/// writes and frees the chunks their threads have moved past, so a long running
+/// program can flush its trace periodically. the buffer of a thread is freed once
+/// the thread has exited and its spans are written or cleared, and its thread
+/// number goes to the next thread. when the tracer is disabled a span costs one
+/// load and one branch.
+///
+///		tracer calls;
+///		calls.enable();
+///		auto f = traced(calls, "score")(make_delegate(&score));
+///		...
+///		std::ofstream file("trace.json");
+///		calls.write(file);
+//---------------------------------------------------------------------------------
+namespace trace_detail {
+
+	struct event
+	{
+		const char * name;
+		std::uint64_t begin;
+		std::uint64_t end;
+		unsigned depth;
+	};
+
+	struct chunk
+	{
+		static const std::size_t capacity = 1024;
+		event events[capacity];
+		std::atomic<std::size_t> count{0};
+		std::atomic<chunk *> next{nullptr};
+	};
+
+	/// spans of one thread
+	struct buffer
+	{
+		explicit buffer(unsigned thread) :thread(thread), first(new chunk), last(first) {}
+
+		buffer(const buffer &) = delete;
+		buffer & operator=(const buffer &) = delete;
+
+		~buffer()
+		{
+			for (auto c = first; c; ) {
+				auto next = c->next.load(std::memory_order_relaxed);
+				delete c;
+				c = next;
+			}
+		}
+
+		// only called by the owning thread
+		void add(event const & e)
+		{
+			auto n = last->count.load(std::memory_order_relaxed);
+			if (n == chunk::capacity) {
+				auto c = new chunk;
+				last->next.store(c, std::memory_order_release);
+				last = c;
+				n = 0;
+			}
+			last->events[n] = e;
+			last->count.store(n + 1, std::memory_order_release);
+		}
+
+		// only called by one reader at a time. passes every published event not
+		// consumed yet to f and deletes the chunks the owning thread has left.
+		template<typename F>
+		void drain(F && f)
+		{
+			for (;;) {
+				auto const count = first->count.load(std::memory_order_acquire);
+				for (; consumed < count; consumed++) {
+					f(first->events[consumed]);
+				}
+				if (count < chunk::capacity) {
+					return;
+				}
+				auto next = first->next.load(std::memory_order_acquire);
+				if (!next) {
+					return;
+				}
+				delete first;
+				first = next;
+				consumed = 0;
+			}
+		}
+
+		const unsigned thread;
+		unsigned depth = 0;
+		// set by the owning thread when it exits
+		std::atomic<bool> closed{false};
+		// reader side
+		chunk * first;
+		std::size_t consumed = 0;
+		// owner side
+		chunk * last;
+	};
+
+	inline std::uint64_t now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+}
+
+class tracer
+{
+public:
+	tracer() :_id(next_id()), _start(trace_detail::now()) {}
+
+	tracer(const tracer &) = delete;
+	tracer & operator=(const tracer &) = delete;
+
+	void enable() { _enabled.store(true, std::memory_order_relaxed); }
+	void disable() { _enabled.store(false, std::memory_order_relaxed); }
+	bool enabled() const { return _enabled.load(std::memory_order_relaxed); }
+
+	/// name for spans, kept for the lifetime of the tracer
+	const char * intern(const std::string & name)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_names.push_back(name);
+		return _names.back().c_str();
+	}
+
+	/// measures a scope as one span
+	class span
+	{
+	public:
+		span(tracer & t, const char * name)
+		:_buffer(t.enabled() ? &t.this_buffer() : nullptr)
+		{
+			if (_buffer) {
+				_event.name = name;
+				_event.depth = _buffer->depth++;
+				_event.begin = trace_detail::now() - t._start;
+				_start = t._start;
+			}
+		}
+
+		~span()
+		{
+			if (_buffer) {
+				_event.end = trace_detail::now() - _start;
+				_buffer->depth--;
+				_buffer->add(_event);
+			}
+		}
+
+		span(const span &) = delete;
+		span & operator=(const span &) = delete;
+
+	private:
+		trace_detail::buffer * _buffer;
+		trace_detail::event _event;
+		std::uint64_t _start;
+	};
+
+	/// writes every span completed since the last write() or clear() as a
+	/// trace-event JSON object and drops it from the tracer
+	void write(std::ostream & out)
+	{
+		std::lock_guard<std::mutex> lock(_drain);
+		auto const buffers = snapshot();
+		auto const pid = ::getpid();
+		out << "{\"traceEvents\":[";
+		const char * separator = "\n";
+		for (auto & b : buffers) {
+			// a buffer closed before it is drained has nothing after that
+			bool const closed = b->closed.load(std::memory_order_acquire);
+			out << separator << "{\"name\":\"thread " << b->thread << "\",\"ph\":\"M\",\"pid\":" << pid
+				<< ",\"tid\":" << b->thread << ",\"args\":{\"name\":\"thread " << b->thread << "\"}}";
+			separator = ",\n";
+			b->drain([&](trace_detail::event const & e)
+			{
+				out << separator << "{\"name\":";
+				write_string(out, e.name);
+				out << ",\"ph\":\"X\",\"ts\":" << microseconds(e.begin)
+					<< ",\"dur\":" << microseconds(e.end - e.begin)
+					<< ",\"pid\":" << pid << ",\"tid\":" << b->thread
+					<< ",\"args\":{\"depth\":" << e.depth << "}}";
+			});
+			if (closed) {
+				retire(b);
+			}
+		}
+		out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+	}
+
+	/// drops every span completed so far. threads may keep tracing.
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(_drain);
+		for (auto & b : snapshot()) {
+			bool const closed = b->closed.load(std::memory_order_acquire);
+			b->drain([](trace_detail::event const &) {});
+			if (closed) {
+				retire(b);
+			}
+		}
+	}
+
+private:
+	static std::uint64_t next_id()
+	{
+		static std::atomic<std::uint64_t> id{1};
+		return id.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// called with _drain held, so no other reader frees the buffers
+	std::vector<std::shared_ptr<trace_detail::buffer>> snapshot() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _buffers;
+	}
+
+	// drops a drained buffer of a thread that exited
+	void retire(std::shared_ptr<trace_detail::buffer> const & b)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_buffers.erase(std::find(_buffers.begin(), _buffers.end(), b));
+	}
+
+	static std::string microseconds(std::uint64_t ns)
+	{
+		char text[32];
+		std::snprintf(text, sizeof(text), "%llu.%03u", (unsigned long long)(ns / 1000), unsigned(ns % 1000));
+		return text;
+	}
+
+	static void write_string(std::ostream & out, const char * s)
+	{
+		out << '"';
+		for (; *s; s++) {
+			if (*s == '"' || *s == '\\') {
+				out << '\\' << *s;
+			} else if (static_cast<unsigned char>(*s) < 0x20) {
+				char escaped[8];
+				std::snprintf(escaped, sizeof(escaped), "\\u%04x", unsigned(*s));
+				out << escaped;
+			} else {
+				out << *s;
+			}
+		}
+		out << '"';
+	}
+
+	trace_detail::buffer & this_buffer()
+	{
+		struct cached { std::uint64_t tracer; trace_detail::buffer * buffer; };
+		static thread_local cached last{0, nullptr};
+		if (last.tracer == _id) {
+			return *last.buffer;
+		}
+		// closes the buffers of this thread when it exits, unless their tracer is gone
+		struct owned { std::uint64_t tracer; std::weak_ptr<trace_detail::buffer> buffer; };
+		struct thread_buffers
+		{
+			~thread_buffers()
+			{
+				for (auto & o : buffers) {
+					if (auto b = o.buffer.lock()) {
+						b->closed.store(true, std::memory_order_release);
+					}
+				}
+			}
+			std::vector<owned> buffers;
+		};
+		static thread_local thread_buffers known;
+		for (auto & k : known.buffers) {
+			if (k.tracer == _id) {
+				last = cached{_id, k.buffer.lock().get()};
+				return *last.buffer;
+			}
+		}
+		known.buffers.erase(std::remove_if(known.buffers.begin(), known.buffers.end(),
+				[](owned const & o) { return o.buffer.expired(); }), known.buffers.end());
+		std::shared_ptr<trace_detail::buffer> added;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			// threads that exited leave their number to new ones
+			std::vector<bool> used(_buffers.size() + 1, false);
+			for (auto & b : _buffers) {
+				if (b->thread < used.size()) {
+					used[b->thread] = true;
+				}
+			}
+			auto const thread = unsigned(std::find(used.begin(), used.end(), false) - used.begin());
+			added.reset(new trace_detail::buffer(thread));
+			_buffers.push_back(added);
+		}
+		known.buffers.push_back({_id, added});
+		last = cached{_id, added.get()};
+		return *added;
+	}
+
+	std::atomic<bool> _enabled{false};
+	const std::uint64_t _id;
+	const std::uint64_t _start;
+	mutable std::mutex _mutex;
+	std::mutex _drain;
+	std::vector<std::shared_ptr<trace_detail::buffer>> _buffers;
+	std::deque<std::string> _names;
+};
+
+//---------------------------------------------------------------------------------
+/// traced aspect
+/// records every call of the wrapped delegate as a span named name.
+/// spans of calls made from inside a traced call are nested below it.
+//---------------------------------------------------------------------------------
+class traced
+{
+public:
+	traced(tracer & t, const std::string & name) :_tracer(&t), _name(t.intern(name)) {}
+
+	template<typename R, typename... Args>
+	delegate<R(Args...)> operator () (delegate<R(Args...)> f) const
+	{
+		auto t = _tracer;
+		auto name = _name;
+		return [t,name,f](delegate_param_t<Args>... args) -> R
+		{
+			tracer::span s(*t, name);
+			return f(std::forward<delegate_param_t<Args>>(args)...);
+		};
+	}
+
+private:
+	tracer * _tracer;
+	const char * _name;
+};